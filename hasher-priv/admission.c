@@ -0,0 +1,613 @@
+/*
+ * The job admission control for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file is executed with root privileges. */
+
+#include "admission.h"
+#include "caller_data.h"
+#include "cgroup.h"
+#include "communication.h"
+#include "epoll.h"
+#include "error_prints.h"
+#include "fds.h"
+#include "logging.h"
+#include "macros.h"
+#include "pass.h"
+#include "pressure.h"
+#include "server_comm.h"
+#include "server_config.h"
+#include "sockets.h"
+#include "unblock_fd.h"
+#include "xmalloc.h"
+#include "xstring.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <linux/un.h>
+
+/*
+ * Job runners ask the main server for a job slot by connecting to
+ * this socket and sending admission_request_t.  The main server answers
+ * with the queue position of the request whenever it changes, and with
+ * zero when the slot is granted.  The slot is owned by the runner until
+ * it closes the connection, which happens when the runner terminates,
+ * however it happens.  The request may be accompanied by a descriptor
+ * of the job cgroup, which lets the main server freeze the job.
+ */
+#define ADMISSION_SOCKET_BASE_NAME "admission"
+
+enum {
+	/* How often to check the pressure stall information. */
+	PSI_CHECK_MSEC = 1000,
+	/*
+	 * How often to freeze or thaw another job on memory pressure;
+	 * the pressure needs that much time to settle down.
+	 */
+	PSI_FREEZE_MSEC = 10000,
+};
+
+typedef struct {
+	uid_t uid;
+	unsigned int num;
+} admission_request_t;
+
+enum slot_state {
+	SLOT_NEW,
+	SLOT_WAITING,
+	SLOT_RUNNING,
+};
+
+struct slot_request {
+	struct slot_request *next;
+	int fd;
+	enum slot_state state;
+	uid_t uid;
+	unsigned int num;
+	unsigned long long seq;
+	unsigned int position;
+	int cgroup_fd;
+	int frozen;
+	/* Jobs running in the same user's sessions and in the same session. */
+	unsigned long user_running;
+	unsigned long session_running;
+};
+
+static int admission_fd = -1;
+static struct slot_request *slot_requests;
+static unsigned long long next_seq;
+static unsigned int n_frozen;
+static long long next_check;
+static long long next_freeze;
+
+/* The slot owned by this runner. */
+static int slot_fd = -1;
+
+int
+admission_init(int fd_ep)
+{
+	char socketpath[UNIX_PATH_MAX];
+	xsprintf(socketpath, "%s/%s", SOCKETDIR, ADMISSION_SOCKET_BASE_NAME);
+
+	if (!server_max_jobs && !server_max_user_jobs &&
+	    !server_psi_cpu_limit && !server_psi_memory_limit &&
+	    !server_psi_io_limit && !server_psi_memory_freeze) {
+		/* Do not let runners wait on a socket left behind. */
+		if (unlink(socketpath) && errno != ENOENT)
+			perror_msg("unlink: %s", socketpath);
+		return 0;
+	}
+
+	mode_t m = umask(077);
+	admission_fd = srv_listen(socketpath, server_listen_backlog);
+	umask(m);
+
+	if (admission_fd < 0)
+		return -1;
+
+	unblock_fd(admission_fd);
+
+	if (epoll_add_in(fd_ep, admission_fd) < 0) {
+		xclose(&admission_fd);
+		return -1;
+	}
+
+	notice_msg("admission control: max_jobs=%lu, max_user_jobs=%lu,"
+		   " psi_cpu_limit=%lu, psi_memory_limit=%lu, psi_io_limit=%lu,"
+		   " psi_memory_freeze=%lu",
+		   server_max_jobs, server_max_user_jobs,
+		   server_psi_cpu_limit, server_psi_memory_limit,
+		   server_psi_io_limit, server_psi_memory_freeze);
+	return 0;
+}
+
+/* Close all admission control descriptors in a child process. */
+void
+admission_close(void)
+{
+	xclose(&admission_fd);
+
+	while (slot_requests) {
+		struct slot_request *r = slot_requests;
+		slot_requests = r->next;
+		xclose(&r->cgroup_fd);
+		xclose(&r->fd);
+		free(r);
+	}
+}
+
+static void
+free_slot_request(int fd_ep, struct slot_request *r)
+{
+	struct slot_request **rp = &slot_requests;
+	while (*rp != r)
+		rp = &(*rp)->next;
+	*rp = r->next;
+
+	if (r->frozen) {
+		(void) freeze_cgroup_fd(r->cgroup_fd, 0);
+		--n_frozen;
+	}
+	xclose(&r->cgroup_fd);
+
+	(void) epoll_del(fd_ep, r->fd);
+	xclose(&r->fd);
+	free(r);
+}
+
+static int
+send_position(struct slot_request *r, unsigned int position)
+{
+	if (send(r->fd, &position, sizeof(position),
+		 MSG_DONTWAIT | MSG_NOSIGNAL) != (ssize_t) sizeof(position)) {
+		if (errno != EPIPE)
+			perror_msg("send");
+		return -1;
+	}
+
+	r->position = position;
+	return 0;
+}
+
+static void
+count_running(void)
+{
+	for (struct slot_request *r = slot_requests; r; r = r->next) {
+		r->user_running = r->session_running = 0;
+
+		for (struct slot_request *s = slot_requests; s; s = s->next) {
+			if (s->state != SLOT_RUNNING || s->uid != r->uid)
+				continue;
+			++r->user_running;
+			if (s->num == r->num)
+				++r->session_running;
+		}
+	}
+}
+
+/*
+ * Requests of users running fewer jobs go first, then requests of their
+ * sessions running fewer jobs, then older requests, so every user gets
+ * an equal share of job slots, split equally between the user's sessions.
+ */
+static int
+slot_request_cmp(const void *a, const void *b)
+{
+	const struct slot_request *x = *(struct slot_request *const *) a;
+	const struct slot_request *y = *(struct slot_request *const *) b;
+
+	if (x->user_running != y->user_running)
+		return x->user_running < y->user_running ? -1 : 1;
+	if (x->session_running != y->session_running)
+		return x->session_running < y->session_running ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/*
+ * Returns the name of a resource the host is saturated with,
+ * or NULL if the host may take another job.
+ */
+static const char *
+saturated_resource(void)
+{
+	static const struct {
+		const char *name;
+		const unsigned long *limit;
+	} resources[] = {
+		{ "cpu", &server_psi_cpu_limit },
+		{ "memory", &server_psi_memory_limit },
+		{ "io", &server_psi_io_limit },
+	};
+
+	for (size_t i = 0; i < ARRAY_SIZE(resources); ++i) {
+		if (!*resources[i].limit)
+			continue;
+
+		double avg10 = read_pressure(resources[i].name, 0);
+		if (avg10 >= (double) *resources[i].limit)
+			return resources[i].name;
+	}
+
+	return NULL;
+}
+
+static int
+may_run(const struct slot_request *r)
+{
+	return !server_max_user_jobs || r->user_running < server_max_user_jobs;
+}
+
+static void
+update_positions(int fd_ep)
+{
+	size_t n = 0;
+	for (struct slot_request *r = slot_requests; r; r = r->next)
+		n += r->state == SLOT_WAITING;
+	if (!n)
+		return;
+
+	struct slot_request **waiting = xcalloc(n, sizeof(*waiting));
+	size_t i = 0;
+	for (struct slot_request *r = slot_requests; r; r = r->next)
+		if (r->state == SLOT_WAITING)
+			waiting[i++] = r;
+	qsort(waiting, n, sizeof(*waiting), slot_request_cmp);
+
+	for (i = 0; i < n; ++i) {
+		unsigned int position = (unsigned int) i + 1;
+		if (waiting[i]->position != position &&
+		    send_position(waiting[i], position) < 0)
+			free_slot_request(fd_ep, waiting[i]);
+	}
+
+	free(waiting);
+}
+
+/* Grant free job slots to the waiting requests in the fair order. */
+static void
+schedule_slots(int fd_ep)
+{
+	for (;;) {
+		count_running();
+
+		unsigned long running = 0;
+		struct slot_request *best = NULL;
+
+		for (struct slot_request *r = slot_requests; r; r = r->next) {
+			if (r->state == SLOT_RUNNING)
+				++running;
+			else if (r->state == SLOT_WAITING && may_run(r) &&
+				 (!best || slot_request_cmp(&r, &best) < 0))
+				best = r;
+		}
+
+		if (!best || (server_max_jobs && running >= server_max_jobs))
+			break;
+
+		/*
+		 * Do not start jobs while the host is under pressure,
+		 * unless there is no running job to relieve the pressure.
+		 */
+		if (running && n_frozen)
+			break;
+		const char *resource = running ? saturated_resource() : NULL;
+		if (resource) {
+			debug_msg("admission: %s pressure is too high", resource);
+			break;
+		}
+
+		if (send_position(best, 0) < 0) {
+			free_slot_request(fd_ep, best);
+			continue;
+		}
+
+		best->state = SLOT_RUNNING;
+		best->seq = next_seq++;
+		debug_msg("admission: job slot granted to %u:%u",
+			  best->uid, best->num);
+	}
+
+	update_positions(fd_ep);
+}
+
+static void
+accept_slot_requests(int fd_ep)
+{
+	for (;;) {
+		/*
+		 * The connection is left in blocking mode with a receive
+		 * timeout for reading the request, see read_slot_request;
+		 * everything else is sent and received with MSG_DONTWAIT.
+		 */
+		int fd = accept4(admission_fd, NULL, 0, SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+			    errno != EINTR)
+				perror_msg("accept4");
+			return;
+		}
+
+		if (set_recv_timeout(fd, 3) < 0) {
+			xclose(&fd);
+			continue;
+		}
+
+		struct slot_request *r = calloc(1, sizeof(*r));
+		if (!r) {
+			perror_msg("calloc");
+			xclose(&fd);
+			continue;
+		}
+
+		r->fd = fd;
+		r->cgroup_fd = -1;
+		r->state = SLOT_NEW;
+
+		if (epoll_add_in(fd_ep, fd) < 0) {
+			xclose(&r->fd);
+			free(r);
+			continue;
+		}
+
+		r->next = slot_requests;
+		slot_requests = r;
+	}
+}
+
+static void
+read_slot_request(int fd_ep, struct slot_request *r)
+{
+	admission_request_t req;
+	int failed;
+
+	if (r->state == SLOT_NEW) {
+		/*
+		 * Wait in epoll until the request starts arriving,
+		 * then read the rest of this fixed-size request right away.
+		 */
+		char c;
+		ssize_t n = recv(r->fd, &c, sizeof(c), MSG_DONTWAIT | MSG_PEEK);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+			      errno == EINTR))
+			return;
+
+		unsigned int n_fds;
+		failed = n <= 0 ||
+			 fd_recv_upto(r->fd, &r->cgroup_fd, 1, &n_fds,
+				      (char *) &req, sizeof(req)) < 0;
+	} else {
+		/* The runner is not expected to send anything else. */
+		char c;
+		ssize_t n = recv(r->fd, &c, sizeof(c), MSG_DONTWAIT);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+			      errno == EINTR))
+			return;
+		if (n > 0)
+			error_msg("admission: unexpected request");
+		else if (n < 0)
+			perror_msg("recv");
+		failed = 1;
+	}
+
+	if (failed) {
+		/* The runner has terminated, or has broken the protocol. */
+		int was_running = r->state == SLOT_RUNNING;
+		free_slot_request(fd_ep, r);
+		if (was_running)
+			schedule_slots(fd_ep);
+		else
+			update_positions(fd_ep);
+		return;
+	}
+
+	r->uid = req.uid;
+	r->num = req.num;
+	r->seq = next_seq++;
+	r->state = SLOT_WAITING;
+	schedule_slots(fd_ep);
+}
+
+/*
+ * On critical memory pressure, freeze the most recently started job,
+ * unless it is the only job that is not frozen yet; once the pressure
+ * goes down to half of the critical level, thaw the earliest frozen job.
+ */
+static void
+check_memory_freeze(long long now)
+{
+	if (now < next_freeze)
+		return;
+
+	double full = read_pressure("memory", 1);
+	if (full < 0)
+		return;
+
+	struct slot_request *victim = NULL;
+	unsigned int n_running = 0;
+
+	if (full >= (double) server_psi_memory_freeze) {
+		for (struct slot_request *r = slot_requests; r; r = r->next) {
+			if (r->state != SLOT_RUNNING || r->frozen)
+				continue;
+			++n_running;
+			if (r->cgroup_fd >= 0 &&
+			    (!victim || r->seq > victim->seq))
+				victim = r;
+		}
+		if (n_running < 2)
+			return;
+
+		if (victim && !freeze_cgroup_fd(victim->cgroup_fd, 1)) {
+			victim->frozen = 1;
+			++n_frozen;
+			notice_msg("memory pressure %.2f%%: froze a job of %u:%u",
+				   full, victim->uid, victim->num);
+		}
+	} else if (n_frozen &&
+		   full < (double) server_psi_memory_freeze / 2) {
+		for (struct slot_request *r = slot_requests; r; r = r->next)
+			if (r->frozen && (!victim || r->seq < victim->seq))
+				victim = r;
+
+		if (victim && !freeze_cgroup_fd(victim->cgroup_fd, 0)) {
+			victim->frozen = 0;
+			--n_frozen;
+			notice_msg("memory pressure %.2f%%: thawed a job of %u:%u",
+				   full, victim->uid, victim->num);
+		}
+	} else {
+		return;
+	}
+
+	next_freeze = now + PSI_FREEZE_MSEC;
+}
+
+/*
+ * Returns the epoll timeout till the next check of the pressure
+ * stall information, or -1 if there is nothing to check.
+ */
+int
+admission_timeout(long long now)
+{
+	int waiting = 0, running = 0;
+
+	for (struct slot_request *r = slot_requests; r; r = r->next) {
+		waiting |= r->state == SLOT_WAITING;
+		running |= r->state == SLOT_RUNNING;
+	}
+
+	if (!(waiting && (server_psi_cpu_limit || server_psi_memory_limit ||
+			  server_psi_io_limit || n_frozen)) &&
+	    !(running && server_psi_memory_freeze))
+		return -1;
+
+	if (next_check <= now)
+		return 0;
+
+	long long timeout = next_check - now;
+	return timeout > PSI_CHECK_MSEC ? PSI_CHECK_MSEC : (int) timeout;
+}
+
+/* Check the pressure stall information if it is time to. */
+void
+admission_tick(int fd_ep, long long now)
+{
+	if (admission_fd < 0 || now < next_check ||
+	    admission_timeout(now) < 0)
+		return;
+
+	next_check = now + PSI_CHECK_MSEC;
+
+	if (server_psi_memory_freeze)
+		check_memory_freeze(now);
+
+	schedule_slots(fd_ep);
+}
+
+/* Returns 1 if the descriptor belongs to the admission control. */
+int
+admission_handle_event(int fd_ep, int fd)
+{
+	if (admission_fd < 0)
+		return 0;
+
+	if (fd == admission_fd) {
+		accept_slot_requests(fd_ep);
+		return 1;
+	}
+
+	for (struct slot_request *r = slot_requests; r; r = r->next) {
+		if (r->fd == fd) {
+			read_slot_request(fd_ep, r);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Wait until the main server grants a job slot to this runner.
+ * If notify is set, report the queue position to the client
+ * while waiting.  If cgroup_fd is valid, the main server may freeze
+ * the job cgroup on memory pressure.  Returns 0 when the job may start,
+ * or -1 if the client has gone away or the main server has failed
+ * to answer.
+ */
+int
+admission_wait(int conn, int notify, int cgroup_fd)
+{
+	int fd = srv_try_connect(SOCKETDIR, ADMISSION_SOCKET_BASE_NAME);
+	if (fd < 0) {
+		/* Admission control is disabled. */
+		if (errno == ENOENT || errno == ECONNREFUSED)
+			return 0;
+		perror_msg("connect: %s/%s",
+			   SOCKETDIR, ADMISSION_SOCKET_BASE_NAME);
+		return -1;
+	}
+
+	admission_request_t req = {
+		.uid = caller_uid,
+		.num = caller_num,
+	};
+
+	if (cgroup_fd >= 0) {
+		fd_send(fd, &cgroup_fd, 1, (const char *) &req, sizeof(req));
+	} else if (xsendmsg(fd, &req, sizeof(req)) < 0) {
+		xclose(&fd);
+		return -1;
+	}
+
+	for (;;) {
+		struct pollfd pfd[] = {
+			{ .fd = fd, .events = POLLIN },
+			{ .fd = conn, .events = POLLRDHUP },
+		};
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror_msg("poll");
+			break;
+		}
+
+		if (pfd[1].revents) {
+			info_msg("client has gone away while waiting"
+				 " for a job slot");
+			break;
+		}
+
+		if (!pfd[0].revents)
+			continue;
+
+		unsigned int position;
+		if (xrecvmsg(fd, &position, sizeof(position)) < 0)
+			break;
+
+		if (!position) {
+			slot_fd = fd;
+			return 0;
+		}
+
+		debug_msg("waiting for a job slot, queue position %u",
+			  position);
+		if (notify)
+			(void) send_response_to_client(conn, CMD_STATUS_QUEUED,
+						       "waiting for a free job slot,"
+						       " queue position %u",
+						       position);
+	}
+
+	xclose(&fd);
+	return -1;
+}
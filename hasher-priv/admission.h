@@ -0,0 +1,20 @@
+/*
+ * The job admission control interface for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_ADMISSION_H
+# define HASHER_ADMISSION_H
+
+int admission_init(int fd_ep);
+int admission_handle_event(int fd_ep, int fd);
+int admission_timeout(long long now);
+void admission_tick(int fd_ep, long long now);
+void admission_close(void);
+int admission_wait(int conn, int notify, int cgroup_fd);
+
+#endif /* !HASHER_ADMISSION_H */
@@ -11,6 +11,7 @@
 
 #include "caller_config.h"
 #include "caller_data.h"
+#include "change_cgroup.h"
 #include "change_rlimit.h"
 #include "chdir.h"
 #include "error_prints.h"
@@ -41,11 +42,18 @@ gid_t   change_gid1, change_gid2;
 mode_t  change_umask = 022;
 int change_nice = 8;
 size_t  change_nproc = 0;
+int     numa_bind;
 int     makedev_console;
 int     use_pty;
+int     use_mount_api;
+int     allow_chroot_image;
+int     use_minimal_mount_ns;
+int     chroot_overlay;
+const char *chroot_overlay_dir;
 size_t  x11_data_len;
 int share_ipc = -1;
 int share_network = -1;
+int share_pid = 1;
 int share_uts = -1;
 change_rlimit_t change_rlimit[] = {
 
@@ -106,6 +114,30 @@ change_rlimit_t change_rlimit[] = {
 	{0, 0, 0, 0}
 };
 
+change_cgroup_t change_cgroup[] = {
+
+/* CPU bandwidth limit, "$MAX $PERIOD" in microseconds.  */
+	{"cpu_max", "cpu", "cpu.max", 0},
+
+/* Relative CPU weight.  */
+	{"cpu_weight", "cpu", "cpu.weight", 0},
+
+/* Memory usage hard limit, in bytes.  */
+	{"memory_max", "memory", "memory.max", 0},
+
+/* Memory usage throttle limit, in bytes.  */
+	{"memory_high", "memory", "memory.high", 0},
+
+/* Number of processes.  */
+	{"pids_max", "pids", "pids.max", 0},
+
+/* Per-device I/O limits.  */
+	{"io_max", "io", "io.max", 0},
+
+/* End of limits.  */
+	{0, 0, 0, 0}
+};
+
 work_limit_t wlimit;
 
 static  mode_t
@@ -213,6 +245,26 @@ parse_rlim(const char *name, const char *value, const char *optname,
 		opt_bad_name(optname, filename);
 }
 
+static void
+parse_cgroup(const char *name, const char *value, const char *optname,
+	     const char *filename)
+{
+	change_cgroup_t *p;
+
+	if (!*value)
+		opt_bad_value(optname, value, filename);
+
+	for (p = change_cgroup; p->name; ++p)
+		if (!strcasecmp(name, p->name))
+		{
+			free(p->value);
+			p->value = xstrdup(value);
+			return;
+		}
+
+	opt_bad_name(optname, filename);
+}
+
 static void
 modify_wlim(unsigned long *pval, const char *value,
 	    const char *optname, const char *filename, int is_system)
@@ -248,14 +300,20 @@ strp_cmp(const void *a, const void *b)
 }
 
 static void
-parse_str_list(const char *value, str_list_t *s)
+clear_str_list(str_list_t *s)
 {
 	if (s->len) {
 		memset(s->list, 0, s->len * sizeof(*s->list));
 		s->len = 0;
 	}
-	if (s->buf)
-		free(s->buf);
+	free(s->buf);
+	s->buf = 0;
+}
+
+static void
+parse_str_list(const char *value, str_list_t *s)
+{
+	clear_str_list(s);
 
 	s->buf = xstrdup(value);
 	char *ctx = 0;
@@ -299,6 +357,23 @@ parse_prefix(const char *name, const char *value, const char *filename)
 	return 0;
 }
 
+static void
+free_prefix_list(void)
+{
+	if (chroot_prefix_list)
+	{
+		char  **prefix = (char **) chroot_prefix_list;
+
+		for (; prefix && *prefix; ++prefix)
+		{
+			free(*prefix);
+			*prefix = 0;
+		}
+		free((char **) chroot_prefix_list);
+	}
+	chroot_prefix_list = 0;
+}
+
 static void
 parse_prefix_list(const char *name, const char *value, const char *filename)
 {
@@ -321,17 +396,7 @@ parse_prefix_list(const char *name, const char *value, const char *filename)
 	free((char *) chroot_prefix_path);
 	chroot_prefix_path = xstrdup(value);
 
-	if (chroot_prefix_list)
-	{
-		char  **prefix = (char **) chroot_prefix_list;
-
-		for (; prefix && *prefix; ++prefix)
-		{
-			free(*prefix);
-			*prefix = 0;
-		}
-		free((char **) chroot_prefix_list);
-	}
+	free_prefix_list();
 	chroot_prefix_list = list;
 }
 
@@ -340,6 +405,7 @@ set_caller_name_value(const char *name, const char *value, const char *filename)
 {
 	const char rlim_prefix[] = "rlimit_";
 	const char wlim_prefix[] = "wlimit_";
+	const char cgroup_prefix[] = "cgroup_";
 
 	if (!strcasecmp("user1", name))
 	{
@@ -357,10 +423,18 @@ set_caller_name_value(const char *name, const char *value, const char *filename)
 		change_nice = str2nice(name, value, filename);
 	else if (!strcasecmp("nproc", name))
 		change_nproc = str2nproc(name, value, filename);
+	else if (!strcasecmp("numa_bind", name))
+		numa_bind = opt_str2bool(name, value, filename);
 	else if (!strcasecmp("allowed_devices", name))
 		parse_str_list(value, &allowed_devices);
 	else if (!strcasecmp("allowed_mountpoints", name))
 		parse_str_list(value, &allowed_mountpoints);
+	else if (!strcasecmp("mount_api", name))
+		use_mount_api = opt_str2bool(name, value, filename);
+	else if (!strcasecmp("minimal_mount_ns", name))
+		use_minimal_mount_ns = opt_str2bool(name, value, filename);
+	else if (!strcasecmp("allow_chroot_image", name))
+		allow_chroot_image = opt_str2bool(name, value, filename);
 	else if (!strcasecmp("allow_ttydev", name))
 		(void) opt_str2bool(name, value, filename);	/* obsolete */
 	else if (!strncasecmp(rlim_prefix, name, sizeof(rlim_prefix) - 1))
@@ -369,6 +443,9 @@ set_caller_name_value(const char *name, const char *value, const char *filename)
 	else if (!strncasecmp(wlim_prefix, name, sizeof(wlim_prefix) - 1))
 		parse_wlim(name + sizeof(wlim_prefix) - 1, value, name,
 			   filename);
+	else if (!strncasecmp(cgroup_prefix, name, sizeof(cgroup_prefix) - 1))
+		parse_cgroup(name + sizeof(cgroup_prefix) - 1, value, name,
+			     filename);
 	else
 		opt_bad_name(name, filename);
 }
@@ -428,9 +505,55 @@ check_user(const char *user_name, uid_t * user_uid, gid_t * user_gid,
 				  name, user_name);
 }
 
+/*
+ * Reset all options that can be set in caller config files
+ * to their default values, so that the configuration can be
+ * loaded again from scratch.
+ */
+static void
+reset_caller_config(void)
+{
+	free_prefix_list();
+	free((char *) chroot_prefix_path);
+	chroot_prefix_path = 0;
+
+	free((char *) change_user1);
+	change_user1 = 0;
+	free((char *) change_user2);
+	change_user2 = 0;
+
+	change_umask = 022;
+	change_nice = 8;
+	change_nproc = 0;
+	numa_bind = 0;
+
+	clear_str_list(&allowed_devices);
+	clear_str_list(&allowed_mountpoints);
+
+	use_mount_api = 0;
+	use_minimal_mount_ns = 0;
+	allow_chroot_image = 0;
+
+	for (change_rlimit_t *p = change_rlimit; p->name; ++p) {
+		free(p->hard);
+		p->hard = 0;
+		free(p->soft);
+		p->soft = 0;
+	}
+
+	for (change_cgroup_t *p = change_cgroup; p->name; ++p) {
+		free(p->value);
+		p->value = 0;
+	}
+
+	memset(&wlimit, 0, sizeof(wlimit));
+}
+
 void
 configure_caller(void)
 {
+	reset_caller_config();
+
 	safe_chdir("/", stat_root_ok_validator);
 	safe_chdir("etc/hasher-priv", stat_root_ok_validator);
 	load_caller_config("system");
@@ -438,7 +561,7 @@ configure_caller(void)
 	safe_chdir("user.d", stat_root_ok_validator);
 
 	char *fname = xasprintf("%u", (unsigned int) caller_uid);
-	if (access(fname, F_OK)) {
+	if (!config_exists(fname)) {
 		free(fname);
 		fname = 0;
 		load_caller_config(caller_user);
@@ -456,7 +579,7 @@ configure_caller(void)
 
 		free(fname);
 		fname = xasprintf("%u:%u", (unsigned int) caller_uid, caller_num);
-		if (access(fname, F_OK)) {
+		if (!config_exists(fname)) {
 			free(fname);
 			fname = xasprintf("%s:%u", caller_user, caller_num);
 		}
@@ -540,11 +663,43 @@ parse_env(char **env)
 	if ((e = getenv("share_network")))
 		share_network = opt_str2bool("share_network", e, "environment");
 
+	if ((e = getenv("share_pid")))
+		share_pid = opt_str2bool("share_pid", e, "environment");
+
 	if ((e = getenv("share_uts")))
 		share_uts = opt_str2bool("share_uts", e, "environment");
 
 	if ((e = getenv("requested_mountpoints")))
 		parse_str_list(e, &requested_mountpoints);
 
+	if ((e = getenv("chroot_overlay")))
+		chroot_overlay = opt_str2bool("chroot_overlay", e, "environment");
+
+	if ((e = getenv("chroot_overlay_dir")) && *e) {
+		chroot_overlay_dir = xstrdup(e);
+		chroot_overlay = 1;
+	}
+
 	environ = saved_environ;
 }
+
+/*
+ * Returns the value of the named boolean option of the job environment,
+ * or def if the job environment does not set it.
+ */
+int
+parse_env_bool(char **env, const char *name, int def)
+{
+	if (!env)
+		return def;
+
+	char **const saved_environ = environ;
+	const char *e;
+
+	environ = env;
+	if ((e = getenv(name)))
+		def = opt_str2bool(name, e, "environment");
+	environ = saved_environ;
+
+	return def;
+}
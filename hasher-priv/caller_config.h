@@ -29,14 +29,21 @@ typedef struct {
 
 void configure_caller(void);
 void parse_env(char **env);
+int parse_env_bool(char **env, const char *name, int def);
 
 extern const char *term;
 
 extern int makedev_console;
 extern int use_pty;
+extern int use_mount_api;
+extern int allow_chroot_image;
+extern int use_minimal_mount_ns;
+extern int chroot_overlay;
+extern const char *chroot_overlay_dir;
 
 extern int share_ipc;
 extern int share_network;
+extern int share_pid;
 extern int share_uts;
 
 extern const char *caller_config_file_name;
@@ -49,6 +56,7 @@ extern gid_t change_gid1, change_gid2;
 extern mode_t change_umask;
 extern int change_nice;
 extern size_t change_nproc;
+extern int numa_bind;
 
 extern str_list_t allowed_devices;
 extern str_list_t allowed_mountpoints;
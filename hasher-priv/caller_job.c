@@ -28,12 +28,14 @@
 #include "server_comm.h"
 #include "signals.h"
 #include "sockets.h"
+#include "spawn_killuid.h"
 #include "title.h"
 #include "xmalloc.h"
 
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <sys/param.h>
@@ -89,6 +91,8 @@ void
 deallocate_job_resources(struct job *job)
 {
 	xclose(&job->chroot_fd);
+	xclose(&job->image_fd);
+	xclose(&job->netns_fd);
 
 	for (unsigned int i = 0; i < ARRAY_SIZE(job->std_fds); ++i) {
 		xclose(&job->std_fds[i]);
@@ -183,15 +187,98 @@ err:
 	return -1;
 }
 
+static void
+close_fds(int *fds, unsigned int n_fds)
+{
+	for (unsigned int i = 0; i < n_fds; ++i)
+		xclose(&fds[i]);
+}
+
+/*
+ * Receive the rest of a CMD_JOB_SUBMIT message.
+ * The descriptors received along with the header are owned by the job
+ * regardless of the outcome.
+ */
+static int
+recv_job_submit(int conn, struct job *job, const cmd_header_t *hdr,
+		int *fds, unsigned int n_fds)
+{
+	job_submit_t js;
+
+	for (unsigned int i = 0; i < n_fds; ++i) {
+		if (i < ARRAY_SIZE(job->std_fds))
+			job->std_fds[i] = fds[i];
+		else if (job->chroot_fd < 0)
+			job->chroot_fd = fds[i];
+		else
+			job->image_fd = fds[i];
+	}
+
+	if (hdr->len < sizeof(js) || xrecvmsg(conn, &js, sizeof(js)) < 0)
+		return -1;
+
+	if (js.version != JOB_PROTO_VERSION) {
+		error_msg("unsupported protocol version: %u", js.version);
+		return -1;
+	}
+
+	if ((unsigned long) hdr->len !=
+	    sizeof(js) + (unsigned long) js.args_len + js.env_len) {
+		error_msg("inconsistent job description size: %u", hdr->len);
+		return -1;
+	}
+
+	job->type = js.type;
+	job->persona = js.persona;
+	job->flags = js.flags;
+
+	if (recv_strings_from_client(conn, &job->argv, js.args_len) < 0 ||
+	    validate_arguments(job->type, job->argv) < 0)
+		return -1;
+
+	if (js.env_len &&
+	    recv_strings_from_client(conn, &job->env, js.env_len) < 0)
+		return -1;
+
+	unsigned int expected_fds = ARRAY_SIZE(job->std_fds);
+	if (job->type == JOB_CHROOTUID1 || job->type == JOB_CHROOTUID2) {
+		++expected_fds;
+		if (js.flags & JOB_SUBMIT_IMAGE)
+			++expected_fds;
+	}
+
+	if (js.flags & ~(JOB_SUBMIT_IMAGE | JOB_SUBMIT_USAGE |
+			 JOB_SUBMIT_PERF | JOB_SUBMIT_QUEUE |
+			 JOB_SUBMIT_ANSWER)) {
+		error_msg("unsupported job flags: %#x", js.flags);
+		return -1;
+	}
+
+	if (n_fds != js.n_fds || n_fds != expected_fds) {
+		error_msg("%s job requires %u descriptors but got %u",
+			  job2str(job->type), expected_fds, n_fds);
+		return -1;
+	}
+
+	job->mask = CMD_JOB_SUBMIT | CMD_JOB_TYPE | CMD_JOB_FDS |
+		    CMD_JOB_ARGUMENTS | CMD_JOB_PERSONALITY;
+	if (job->env)
+		job->mask |= CMD_JOB_ENVIRON;
+	if (job->chroot_fd >= 0)
+		job->mask |= CMD_JOB_CHROOT_FD;
+
+	return 0;
+}
+
 int
-wait_job(const struct job *job, pid_t pid)
+wait_job(const struct job *job, pid_t pid, struct rusage *ru)
 {
 	int rc = EXIT_FAILURE;
 	int status;
 
-	pid = waitpid_retry(pid, &status, 0);
+	pid = wait4_retry(pid, &status, 0, ru);
 	if (pid < 0) {
-		perror_msg("waitpid");
+		perror_msg("wait4");
 	} else if (WIFEXITED(status)) {
 		rc = WEXITSTATUS(status);
 		if (rc) {
@@ -242,6 +329,18 @@ validate_job(const struct job *job)
 	return 0;
 }
 
+ATTRIBUTE_NORETURN
+static void
+run_job(struct hadaemon *d, int conn, struct job *job)
+{
+	if (validate_job(job) < 0)
+		respond_bad_request(conn, job);
+	if (spawn_job_runner(d, conn, job) < 0)
+		respond_server_error(conn, job);
+	/* spawn_job_runner() sends a response by itself and exits. */
+	exit(EXIT_SUCCESS);
+}
+
 ATTRIBUTE_NORETURN
 static void
 receive_job_request(struct hadaemon *d, int conn, struct job *job)
@@ -253,11 +352,37 @@ receive_job_request(struct hadaemon *d, int conn, struct job *job)
 	xclose(&d->fd_conn);
 	xclose(&d->fd_pipe[0]);
 
+	/* The job might have been received by the session server already. */
+	if (job->mask)
+		run_job(d, conn, job);
+
 	for (;;) {
 		cmd_header_t hdr = { 0 };
+		int fds[JOB_SUBMIT_MAX_FDS];
+		unsigned int n_fds = 0;
 
-		if (xrecvmsg(conn, &hdr, sizeof(hdr)) < 0)
+		if (fd_recv_upto(conn, fds, ARRAY_SIZE(fds), &n_fds,
+				 (char *) &hdr, sizeof(hdr)) < 0) {
+			close_fds(fds, n_fds);
 			respond_server_error(conn, job);
+		}
+
+		if (hdr.type == CMD_JOB_SUBMIT) {
+			if (job->mask) {
+				close_fds(fds, n_fds);
+				error_msg("unexpected command: %d", hdr.type);
+				respond_bad_request(conn, job);
+			}
+			if (recv_job_submit(conn, job, &hdr, fds, n_fds) < 0)
+				respond_bad_request(conn, job);
+			run_job(d, conn, job);
+		}
+
+		if (n_fds) {
+			close_fds(fds, n_fds);
+			error_msg("unexpected descriptors");
+			respond_bad_request(conn, job);
+		}
 
 		if (job->mask & hdr.type) {
 			error_msg("repeated command: %d", hdr.type);
@@ -301,12 +426,9 @@ receive_job_request(struct hadaemon *d, int conn, struct job *job)
 			break;
 
 		case CMD_JOB_RUN:
-			if (hdr.len || validate_job(job) < 0)
+			if (hdr.len)
 				respond_bad_request(conn, job);
-			if (spawn_job_runner(d, conn, job) < 0)
-				respond_server_error(conn, job);
-			/* spawn_job_runner() sends a response by itself and exits. */
-			exit(EXIT_SUCCESS);
+			run_job(d, conn, job);
 
 		default:
 			error_msg("unknown command: %d", hdr.type);
@@ -317,15 +439,106 @@ receive_job_request(struct hadaemon *d, int conn, struct job *job)
 	}
 }
 
-int
+static char *
+format_query(job_enum_t type)
+{
+	switch (type) {
+	case JOB_GETCONF:
+		return format_getconf();
+	case JOB_GETUGID1:
+		return format_getugid1();
+	case JOB_GETUGID2:
+		return format_getugid2();
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Answer a read-only query submitted in a single message right in the
+ * session server, without forking off job handler, runner and executor.
+ * The answer is sent to the client along with the response, so that the
+ * session server never writes to the stdout of the client, which could
+ * block it.
+ *
+ * Returns 0 if the request is not such a query and has been left intact,
+ * or 1 if it has been received and the client has been answered.
+ */
+static int
+answer_query(int conn, struct job *job, int *rc)
+{
+	struct {
+		cmd_header_t hdr;
+		job_submit_t js;
+	} req;
+
+	ssize_t n = recv(conn, &req, sizeof(req), MSG_PEEK | MSG_DONTWAIT);
+	if (n != (ssize_t) sizeof(req) ||
+	    req.hdr.type != CMD_JOB_SUBMIT ||
+	    req.hdr.len != sizeof(req.js) ||
+	    req.js.version != JOB_PROTO_VERSION ||
+	    req.js.flags != JOB_SUBMIT_ANSWER)
+		return 0;
+
+	char *answer = format_query(req.js.type);
+	if (!answer)
+		return 0;
+
+	int fds[JOB_SUBMIT_MAX_FDS];
+	unsigned int n_fds = 0;
+
+	*rc = EXIT_FAILURE;
+
+	if (fd_recv_upto(conn, fds, ARRAY_SIZE(fds), &n_fds,
+			 (char *) &req, sizeof(req)) < 0) {
+		close_fds(fds, n_fds);
+		send_response_to_client(conn, CMD_STATUS_FAILED,
+					"command failed");
+		goto out;
+	}
+
+	/* The descriptors are not used, but the client has to pass them. */
+	close_fds(fds, n_fds);
+	if (n_fds != ARRAY_SIZE(job->std_fds) || n_fds != req.js.n_fds) {
+		error_msg("%s job requires %u descriptors but got %u",
+			  job2str(req.js.type),
+			  (unsigned int) ARRAY_SIZE(job->std_fds), n_fds);
+		send_response_to_client(conn, CMD_STATUS_FAILED,
+					"bad request");
+		goto out;
+	}
+
+	if (send_response_to_client(conn, CMD_STATUS_ANSWER,
+				    "%s", answer) == 0)
+		*rc = EXIT_SUCCESS;
+	info_msg("%s/%u:%u: %s: answered by the session server",
+		 caller_user, caller_uid, caller_num, job2str(req.js.type));
+
+out:
+	free(answer);
+	return 1;
+}
+
+/*
+ * Returns the pid of the job request handler process,
+ * 0 if the request has been answered successfully without forking,
+ * or -1 otherwise.
+ */
+pid_t
 spawn_job_request_handler(struct hadaemon *d, int conn)
 {
 	struct job job = {
 		.persona = -1U,
 		.chroot_fd = -1,
+		.image_fd = -1,
+		.netns_fd = -1,
 		.std_fds = { -1, -1, -1 },
 		.pipe_fds = { -1, -1 }
 	};
+	int rc;
+
+	if (answer_query(conn, &job, &rc))
+		return rc == EXIT_SUCCESS ? 0 : -1;
 
 	/*
 	 * Move the job request handling into a subprocess
@@ -334,13 +547,20 @@ spawn_job_request_handler(struct hadaemon *d, int conn)
 	pid_t pid = fork();
 	if (pid < 0) {
 		perror_msg("fork");
+		deallocate_job_resources(&job);
 		send_response_to_client(conn, CMD_STATUS_FAILED,
 					"command failed");
-		return EXIT_FAILURE;
+		return -1;
 	}
 	if (pid > 0) {
-		return wait_job(&job, pid);
+		/*
+		 * The handler is reaped by the session server
+		 * asynchronously, see caller_server().
+		 */
+		deallocate_job_resources(&job);
+		return pid;
 	}
 
+	killuid_close_jobs();
 	receive_job_request(d, conn, &job);
 }
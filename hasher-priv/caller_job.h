@@ -14,20 +14,25 @@
 # include "daemon.h"
 # include <sys/types.h>
 
+struct rusage;
+
 struct job {
 	job_enum_t type;
 	unsigned int mask;
 	unsigned int num;
 	unsigned int persona;
+	unsigned int flags;
 	int chroot_fd;
+	int image_fd;
+	int netns_fd;
 	int std_fds[3];
 	int pipe_fds[2];
 	char **argv;
 	char **env;
 };
 
-int spawn_job_request_handler(struct hadaemon *, int conn);
-int wait_job(const struct job *, pid_t);
+pid_t spawn_job_request_handler(struct hadaemon *, int conn);
+int wait_job(const struct job *, pid_t, struct rusage *);
 void deallocate_job_resources(struct job *);
 
 #endif /* HASHER_CALLER_JOB_H */
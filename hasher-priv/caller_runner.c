@@ -12,32 +12,42 @@
 
 /* Code in this file may be executed with root or caller privileges. */
 
+#include "admission.h"
 #include "caller_config.h"
 #include "caller_data.h"
 #include "caller_job.h"
 #include "caller_runner.h"
 #include "cgroup.h"
 #include "communication.h"
+#include "cpu_alloc.h"
 #include "epoll.h"
 #include "error_prints.h"
 #include "executors.h"
 #include "fds.h"
 #include "io_loop.h"
 #include "job2str.h"
+#include "jobserver.h"
 #include "logging.h"
 #include "macros.h"
+#include "netns_pool.h"
+#include "perf_counters.h"
+#include "process.h"
 #include "server_comm.h"
 #include "signals.h"
+#include "spawn_killuid.h"
 #include "title.h"
 #include "xmalloc.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <pwd.h>
 #include <grp.h>
 #include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/signalfd.h>
 
 static int
@@ -54,11 +64,21 @@ is_job_spawning(const struct job *job)
 
 ATTRIBUTE_NORETURN
 static void
-job_executor(struct job *job)
+job_executor(struct job *job, int cgroup_fd)
 {
 	setproctitle("%s %s/%u:%u",
 		     job2str(job->type), caller_user, caller_uid, caller_num);
 
+	/*
+	 * Only the executor and its descendants go to the job cgroup,
+	 * so that killing all processes of the job cgroup once the job
+	 * has finished does not kill the runner.
+	 */
+	if (cgroup_fd >= 0) {
+		join_cgroup_fd(cgroup_fd);
+		xclose(&cgroup_fd);
+	}
+
 	/*
 	 * As we are not going to handle signals, unblock them.
 	 */
@@ -71,6 +91,8 @@ job_executor(struct job *job)
 	init_log_standalone();
 
 	chroot_fd = job->chroot_fd;
+	image_fd = job->image_fd;
+	netns_fd = job->netns_fd;
 
 	/* Check and sanitize file descriptors. */
 	sanitize_fds();
@@ -108,11 +130,24 @@ job_executor(struct job *job)
 		default:
 			error_msg_and_die("unknown job %d", job->type);
 	}
+
+	/*
+	 * Report the exit status to the runner right away, so that
+	 * the client does not wait for the teardown of the namespaces
+	 * of this process that happens when it exits.
+	 */
+	if (status_fd >= 0) {
+		int status = rc & 0xff;
+		if (write_retry(status_fd, &status, sizeof(status)) !=
+		    (ssize_t) sizeof(status))
+			perror_msg("write");
+		xclose(&status_fd);
+	}
 	exit(rc);
 }
 
 static int
-spawn_job_executor(struct job *job)
+spawn_job_executor(struct job *job, int cgroup_fd)
 {
 	pid_t pid = fork();
 	if (pid < 0) {
@@ -122,7 +157,7 @@ spawn_job_executor(struct job *job)
 	if (pid > 0) {
 		return pid;
 	}
-	job_executor(job);
+	job_executor(job, cgroup_fd);
 }
 
 static void
@@ -131,20 +166,107 @@ terminate_executor(const struct job *job, pid_t pid)
 	if (kill(pid, SIGTERM))
 		perror_msg("kill");
 	else
-		wait_job(job, pid);
+		wait_job(job, pid, NULL);
+}
+
+static unsigned long long
+timeval2usec(const struct timeval *tv)
+{
+	return (unsigned long long) tv->tv_sec * 1000000ULL +
+	       (unsigned long long) tv->tv_usec;
 }
 
+static unsigned long long
+elapsed_usec(const struct timespec *start)
+{
+	struct timespec now;
+
+	if (!start->tv_sec || clock_gettime(CLOCK_MONOTONIC, &now))
+		return 0;
+
+	long long usec = (long long) (now.tv_sec - start->tv_sec) * 1000000LL +
+			 (now.tv_nsec - start->tv_nsec) / 1000;
+	return usec > 0 ? (unsigned long long) usec : 0;
+}
+
+/*
+ * Wait for the executor, report its exit status to the client,
+ * followed by the resources consumed by the job if the client asked for it.
+ * If the job ran in a job cgroup, prefer its accounting over the rusage
+ * of the executor which does not cover processes that were not waited for.
+ */
 ATTRIBUTE_NORETURN
 static void
-respond_job_completion(int conn, int rc)
+respond_job_completion(int conn, const struct job *job, pid_t pid,
+		       int cgroup_fd, const struct timespec *start)
 {
-	send_response_to_client(conn, rc, NULL);
+	struct rusage ru = { 0 };
+	int rc = wait_job(job, pid, &ru);
+
+	jobserver_release();
+	killuid_finish_job();
+
+	/* The exit status has already been reported. */
+	if (conn < 0)
+		exit(EXIT_SUCCESS);
+
+	if (!(job->flags & JOB_SUBMIT_USAGE)) {
+		send_response_to_client(conn, rc, NULL);
+		exit(EXIT_SUCCESS);
+	}
+
+	job_usage_t usage = {
+		.wall_usec = elapsed_usec(start),
+		.user_usec = timeval2usec(&ru.ru_utime),
+		.system_usec = timeval2usec(&ru.ru_stime),
+		.max_rss = (unsigned long long) ru.ru_maxrss * 1024,
+		.minor_faults = (unsigned long long) ru.ru_minflt,
+		.major_faults = (unsigned long long) ru.ru_majflt,
+		.voluntary_switches = (unsigned long long) ru.ru_nvcsw,
+		.involuntary_switches = (unsigned long long) ru.ru_nivcsw,
+		.blocks_read = (unsigned long long) ru.ru_inblock,
+		.blocks_written = (unsigned long long) ru.ru_oublock,
+	};
+
+	if (cgroup_fd >= 0)
+		read_cgroup_usage(cgroup_fd, &usage);
+
+	report_perf_counters(&usage);
+
+	if (send_response_to_client(conn, rc, NULL) == 0)
+		send_usage_to_client(conn, &usage);
 	exit(EXIT_SUCCESS);
 }
 
+/*
+ * Receive the exit status of the job from the executor and report it
+ * to the client, which does not have to wait any longer.
+ * The connection is closed; the executor is waited for later.
+ */
+static void
+forward_job_status(int fd_ep, int *status_rfd, int *conn)
+{
+	int rc;
+	ssize_t n = read_retry(*status_rfd, &rc, sizeof(rc));
+
+	(void) epoll_del(fd_ep, *status_rfd);
+	xclose(status_rfd);
+
+	/* The executor has terminated without reporting. */
+	if (n != (ssize_t) sizeof(rc))
+		return;
+
+	/* Let the session server kill the leftovers of the job. */
+	killuid_finish_job();
+	send_response_to_client(*conn, rc, NULL);
+	(void) epoll_del(fd_ep, *conn);
+	xclose(conn);
+}
+
 ATTRIBUTE_NORETURN
 static void
-job_runner(struct hadaemon *d ATTRIBUTE_UNUSED, int conn, struct job *job)
+job_runner(struct hadaemon *d ATTRIBUTE_UNUSED, int conn, struct job *job,
+	   int caller_cgroup_fd, int cgroup_fd)
 {
 	setproctitle("runner %s/%u:%u: %s",
 		     caller_user, caller_uid, caller_num, job2str(job->type));
@@ -154,13 +276,28 @@ job_runner(struct hadaemon *d ATTRIBUTE_UNUSED, int conn, struct job *job)
 	 * unprivileged processes on behalf of the client, and these
 	 * processes can take as much resources as they are allowed to.
 	 * Therefore, chrootuid jobs are moved to the cgroup of the client
-	 * so the cgroup regulations of the client apply to them.
+	 * so the cgroup regulations of the client apply to them; if cgroup
+	 * limits are configured, the executor is moved to a job cgroup
+	 * created under job_cgroup_parent instead.
 	 * Other kinds of jobs are short-lived processes that perform very
 	 * specific auxiliary tasks, they are parts of the service daemon
 	 * and remain in its cgroup.
+	 * The runner and the executor are forked and join their cgroups
+	 * afterwards rather than being created right in them by clone3
+	 * with CLONE_INTO_CGROUP: glibc provides no clone3 wrapper, and
+	 * a child of a raw clone3 syscall, which keeps a stale thread id
+	 * in glibc and skips the atfork handlers, may use only
+	 * async-signal-safe functions, while both run plenty of library code.
+	 */
+	if (caller_cgroup_fd >= 0) {
+		join_cgroup_fd(caller_cgroup_fd);
+		xclose(&caller_cgroup_fd);
+	}
+
+	/*
+	 * Keep the job cgroup open to read its accounting at completion;
+	 * its lock keeps it from being removed until the runner exits.
 	 */
-	if (is_job_spawning(job))
-		join_caller_cgroup(caller_pid);
 
 	/*
 	 * Do not wait for daemon_create_signal_fd() invocation and
@@ -168,11 +305,97 @@ job_runner(struct hadaemon *d ATTRIBUTE_UNUSED, int conn, struct job *job)
 	 */
 	block_signal_handler(SIGCHLD, SIG_BLOCK);
 
-	int pid = spawn_job_executor(job);
+	/*
+	 * Let the job handler exit before the runner waits for a job slot
+	 * and for the leftovers to be killed, so that waiting jobs do not
+	 * count against max_job_handlers of the session server.
+	 */
+	if (is_job_spawning(job))
+		(void) xclose(&job->pipe_fds[1]);
+
+	/*
+	 * Wait for a job slot before the job takes any more resources;
+	 * the slot is released when the runner terminates.
+	 */
+	if (is_job_spawning(job) &&
+	    admission_wait(conn, !!(job->flags & JOB_SUBMIT_QUEUE),
+			   cgroup_fd) < 0) {
+		send_response_to_client(conn, CMD_STATUS_FAILED, NULL);
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * Wait until the session server has killed the leftovers
+	 * of the previous jobs, if it is doing so.  A job that runs in
+	 * an IPC namespace of its own does not leave anything behind
+	 * if it also runs in a PID namespace of its own, whose processes
+	 * are killed along with its init, or in a job cgroup, whose
+	 * processes are killed through the cgroup.  Only namespaces that
+	 * the executor must not go without count: unless share_ipc is
+	 * disabled explicitly, the executor silently falls back to the host
+	 * IPC namespace if it cannot create one, and share_pid is strict.
+	 */
+	if (is_job_spawning(job)) {
+		int own_ipc = !parse_env_bool(job->env, "share_ipc",
+					      share_ipc);
+		int own_pid = !parse_env_bool(job->env, "share_pid",
+					      share_pid);
+
+		if (killuid_start_job(conn,
+				      own_ipc && (own_pid || cgroup_fd >= 0),
+				      own_pid ? -1 : cgroup_fd) < 0) {
+			send_response_to_client(conn, CMD_STATUS_FAILED, NULL);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	/*
+	 * Allocate CPUs for the job that no other job owns; the allocation
+	 * is released when the runner terminates.
+	 */
+	if (is_job_spawning(job)) {
+		(void) allocate_job_cpus(change_nproc);
+		(void) jobserver_prepare_job(change_nproc);
+	}
+
+	/*
+	 * The executor collects performance counters of the job
+	 * into memory shared with the runner.
+	 */
+	if (is_job_spawning(job) &&
+	    (job->flags & (JOB_SUBMIT_USAGE | JOB_SUBMIT_PERF)) ==
+	    (JOB_SUBMIT_USAGE | JOB_SUBMIT_PERF))
+		(void) prepare_perf_counters();
+
+	/*
+	 * Unless the client asked for the resources consumed by the job,
+	 * which are known only when the executor terminates, let the
+	 * executor report the exit status of the job as soon as it is known.
+	 */
+	int status_rfd = -1;
+	if (is_job_spawning(job) && !(job->flags & JOB_SUBMIT_USAGE)) {
+		int fds[2];
+
+		if (pipe2(fds, O_CLOEXEC)) {
+			perror_msg("pipe2");
+		} else {
+			status_rfd = fds[0];
+			status_fd = fds[1];
+		}
+	}
+
+	struct timespec start = { 0 };
+	if (clock_gettime(CLOCK_MONOTONIC, &start))
+		perror_msg("clock_gettime");
+
+	int pid = spawn_job_executor(job, cgroup_fd);
 	if (pid < 0)
 		exit(EXIT_FAILURE);
 
 	deallocate_job_resources(job);
+	xclose(&jobserver_rfd);
+	xclose(&jobserver_wfd);
+	xclose(&status_fd);
 
 	/*
 	 * Do not assume that fs.suid_dumpable == 0
@@ -203,11 +426,12 @@ job_runner(struct hadaemon *d ATTRIBUTE_UNUSED, int conn, struct job *job)
 	 * Instead, we poll `conn' for events.
 	 */
 	if (epoll_add_in(d->fd_ep, d->fd_signal) < 0 ||
-	    epoll_add_hup(d->fd_ep, conn) < 0)
+	    epoll_add_hup(d->fd_ep, conn) < 0 ||
+	    (status_rfd >= 0 && epoll_add_in(d->fd_ep, status_rfd) < 0))
 		perror_msg_and_die("epoll_add");
 
 	int finish_server = 0;
-	const int ep_timeout = -1;
+	const int ep_timeout = jobserver_active() ? JOBSERVER_TICK_MSEC : -1;
 
 	while (!finish_server) {
 		errno = 0;
@@ -220,6 +444,15 @@ job_runner(struct hadaemon *d ATTRIBUTE_UNUSED, int conn, struct job *job)
 			break;
 		}
 
+		jobserver_balance();
+
+		/* The client is expected to disconnect once it is notified. */
+		for (int i = 0; i < fdcount; i++) {
+			if (status_rfd >= 0 && ev[i].data.fd == status_rfd)
+				forward_job_status(d->fd_ep, &status_rfd,
+						   &conn);
+		}
+
 		for (int i = 0; i < fdcount; i++) {
 			if (!(ev[i].events & (EPOLLHUP | EPOLLERR)))
 				continue;
@@ -227,6 +460,7 @@ job_runner(struct hadaemon *d ATTRIBUTE_UNUSED, int conn, struct job *job)
 			if (ev[i].data.fd == conn) {
 				notice_msg("client disconnected, terminating executor");
 				terminate_executor(job, pid);
+				jobserver_release();
 				exit(EXIT_FAILURE);
 			}
 		}
@@ -247,7 +481,6 @@ job_runner(struct hadaemon *d ATTRIBUTE_UNUSED, int conn, struct job *job)
 					continue;
 				}
 
-				int rc;
 				switch (fdsi.ssi_signo) {
 				case SIGHUP:
 				case SIGINT:
@@ -258,8 +491,8 @@ job_runner(struct hadaemon *d ATTRIBUTE_UNUSED, int conn, struct job *job)
 					finish_server = 1;
 					break;
 				case SIGCHLD:
-					rc = wait_job(job, pid);
-					respond_job_completion(conn, rc);
+					respond_job_completion(conn, job, pid,
+							       cgroup_fd, &start);
 				default:
 					error_msg("unexpected signal %d ignored",
 						  fdsi.ssi_signo);
@@ -271,32 +504,66 @@ job_runner(struct hadaemon *d ATTRIBUTE_UNUSED, int conn, struct job *job)
 
 	info_msg("terminating executor");
 	terminate_executor(job, pid);
-	send_response_to_client(conn, CMD_STATUS_FAILED, NULL);
+	jobserver_release();
+	if (conn >= 0)
+		send_response_to_client(conn, CMD_STATUS_FAILED, NULL);
 	exit(EXIT_FAILURE);
 }
 
 pid_t
 spawn_job_runner(struct hadaemon *d, int conn, struct job *job)
 {
+	/*
+	 * Take a network namespace from the pool only for a job that is
+	 * not going to share the network, see unshare_network().
+	 */
+	if (is_job_spawning(job) &&
+	    parse_env_bool(job->env, "share_network", share_network) <= 0)
+		job->netns_fd = netns_pool_take();
+	netns_pool_close();
+
 	if (is_job_spawning(job) &&
 	    pipe(job->pipe_fds)) {
 		perror_msg("pipe");
 		return -1;
 	}
 
+	/*
+	 * Open the cgroup of the client the runner of a chrootuid job
+	 * is going to join, and create the job cgroup, if necessary.
+	 */
+	int caller_cgroup_fd = -1;
+	int cgroup_fd = -1;
+	if (is_job_spawning(job) &&
+	    (open_caller_cgroup(caller_pid, &caller_cgroup_fd) < 0 ||
+	     (need_job_cgroup() && (cgroup_fd = open_job_cgroup()) < 0))) {
+		xclose(&caller_cgroup_fd);
+		(void) xclose(&job->pipe_fds[0]);
+		(void) xclose(&job->pipe_fds[1]);
+		return -1;
+	}
+
 	pid_t pid = fork();
 	if (pid < 0) {
 		perror_msg("fork");
+		xclose(&caller_cgroup_fd);
+		xclose(&cgroup_fd);
+		if (is_job_spawning(job)) {
+			(void) xclose(&job->pipe_fds[0]);
+			(void) xclose(&job->pipe_fds[1]);
+		}
 		return -1;
 	}
 
 	if (pid > 0) {
+		xclose(&caller_cgroup_fd);
+		xclose(&cgroup_fd);
 		if (is_job_spawning(job)) {
 			(void) xclose(&job->pipe_fds[1]);
 			/*
 			 * Wait until the child process closes
 			 * the writing end of the pipe which happens
-			 * when the executor sanitizes its descriptors.
+			 * when the runner is about to wait for a job slot.
 			 */
 			char buf[1];
 			(void) read_retry(job->pipe_fds[0], buf, sizeof(buf));
@@ -307,10 +574,10 @@ spawn_job_runner(struct hadaemon *d, int conn, struct job *job)
 		 * specific auxiliary tasks, they are parts of the service daemon
 		 * and could be trusted to not linger too long.
 		 */
-		(void) wait_job(job, pid);
+		(void) wait_job(job, pid, NULL);
 		return 0;
 	}
 
 	(void) xclose(&job->pipe_fds[0]);
-	job_runner(d, conn, job);
+	job_runner(d, conn, job, caller_cgroup_fd, cgroup_fd);
 }
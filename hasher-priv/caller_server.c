@@ -16,16 +16,24 @@
 #include "caller_data.h"
 #include "caller_job.h"
 #include "caller_server.h"
+#include "cgroup.h"
 #include "communication.h"
+#include "config_watch.h"
 #include "epoll.h"
 #include "error_prints.h"
 #include "fds.h"
+#include "file_config.h"
 #include "io_loop.h"
 #include "macros.h"
+#include "mount.h"
+#include "mount_ns.h"
+#include "netns_pool.h"
 #include "process.h"
 #include "server_config.h"
 #include "signals.h"
+#include "spawn_killuid.h"
 #include "sockets.h"
+#include "user_groups.h"
 #include "xmalloc.h"
 #include "xstring.h"
 
@@ -33,6 +41,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <grp.h>
 
@@ -61,6 +70,79 @@ check_peer_creds(int conn)
 	return 0;
 }
 
+/* The inotify descriptor watching configuration directories. */
+static int config_watch_fd = -1;
+
+/*
+ * Load config according to the caller information
+ * and prepare everything that depends on it.
+ */
+static void
+configure_session(void)
+{
+	configure_caller();
+	prepare_mountpoints();
+	prepare_mount_ns();
+	prepare_user_groups();
+}
+
+/*
+ * Load the configuration again after a change reported by inotify.
+ * The new configuration is checked in a child process first,
+ * so that a broken configuration does not terminate the session,
+ * which keeps using the old one in that case.  The child passes back
+ * the contents of the configuration files it has checked, and exactly
+ * these contents are loaded, so that changes made after the check do
+ * not matter.  Job handlers already forked keep the configuration
+ * they have inherited.
+ */
+static void
+reconfigure_session(void)
+{
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC)) {
+		perror_msg("pipe2");
+		return;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror_msg("fork");
+		xclose(&fds[0]);
+		xclose(&fds[1]);
+		return;
+	}
+	if (!pid) {
+		xclose(&fds[0]);
+		config_snapshot_record();
+		configure_caller();
+		release_mountpoints();
+		load_fstab();
+		exit(config_snapshot_send(fds[1]) ? EXIT_FAILURE
+						   : EXIT_SUCCESS);
+	}
+
+	xclose(&fds[1]);
+	int rc = config_snapshot_receive(fds[0]);
+	xclose(&fds[0]);
+
+	int status;
+	if (waitpid_retry(pid, &status, 0) != pid ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) || rc < 0) {
+		config_snapshot_release();
+		error_msg("%s/%u:%u: configuration is broken, not reloaded",
+			  caller_user, caller_uid, caller_num);
+		return;
+	}
+
+	release_mountpoints();
+	configure_session();
+	config_snapshot_release();
+	killuid_reset();
+	info_msg("%s/%u:%u: configuration reloaded",
+		 caller_user, caller_uid, caller_num);
+}
+
 int
 caller_server_listener_init(struct hadaemon *sdae)
 {
@@ -68,15 +150,21 @@ caller_server_listener_init(struct hadaemon *sdae)
 	sdae->fd_signal = -1;
 	sdae->fd_conn = -1;
 
-	/* Load config according to the caller information. */
-	configure_caller();
+	/*
+	 * Start watching before loading config
+	 * so that no changes are missed.
+	 */
+	config_watch_fd = config_watch_init();
+
+	configure_session();
 
 	char socketpath[UNIX_PATH_MAX];
 	xsprintf(socketpath, "%s/%d:%u", SOCKETDIR, caller_uid, caller_num);
 
 	umask(077);
 
-	if ((sdae->fd_conn = srv_listen(socketpath)) < 0)
+	if ((sdae->fd_conn = srv_listen(socketpath,
+				       server_listen_backlog)) < 0)
 		return -1;
 
 	if (chown(socketpath, caller_uid, caller_gid)) {
@@ -100,9 +188,17 @@ caller_server_listener_init(struct hadaemon *sdae)
 		goto fail;
 	}
 
+	if (config_watch_fd >= 0 &&
+	    epoll_add_in(sdae->fd_ep, config_watch_fd) < 0)
+		goto fail;
+
+	if (netns_pool_init() < 0)
+		goto fail;
+
 	return 0;
 
 fail:
+	xclose(&config_watch_fd);
 	xclose(&sdae->fd_ep);
 	xclose(&sdae->fd_signal);
 	xclose(&sdae->fd_conn);
@@ -112,17 +208,107 @@ fail:
 	return -1;
 }
 
+/* The job request handlers in flight. */
+static pid_t *handler_pids;
+static unsigned long n_handlers, max_handlers;
+
+static void
+add_job_handler(pid_t pid)
+{
+	if (n_handlers == max_handlers) {
+		max_handlers = max_handlers ? max_handlers * 2 : 16;
+		handler_pids = xreallocarray(handler_pids, max_handlers,
+					     sizeof(*handler_pids));
+	}
+	handler_pids[n_handlers++] = pid;
+}
+
+/* Returns 1 if the process is a job request handler, 0 otherwise. */
+static int
+remove_job_handler(pid_t pid)
+{
+	for (unsigned long i = 0; i < n_handlers; ++i) {
+		if (handler_pids[i] == pid) {
+			handler_pids[i] = handler_pids[--n_handlers];
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Stop accepting new connections while the limit of job request
+ * handlers is reached, and resume when some of them are finished.
+ */
+static void
+update_accepting(struct hadaemon *sdae)
+{
+	static int accepting = 1;
+	int want = n_handlers < server_max_job_handlers;
+
+	if (want == accepting)
+		return;
+
+	if ((want ? epoll_add_in(sdae->fd_ep, sdae->fd_conn)
+		  : epoll_del(sdae->fd_ep, sdae->fd_conn)) < 0)
+		perror_msg_and_die("epoll_ctl");
+	accepting = want;
+}
+
+/*
+ * Returns the number of job request handlers that have finished
+ * successfully, that is, received a valid job request.
+ */
+static unsigned int
+wait_job_handlers(void)
+{
+	unsigned int n_valid = 0;
+
+	for (;;) {
+		int status;
+		pid_t pid = waitpid_retry(-1, &status, WNOHANG);
+		if (pid <= 0) {
+			if (pid < 0 && errno != ECHILD)
+				perror_msg("waitpid");
+			break;
+		}
+
+		if (netns_pool_reaped(pid, status) ||
+		    killuid_reaped(pid, status) ||
+		    !remove_job_handler(pid))
+			continue;
+
+		if (WIFEXITED(status)) {
+			int rc = WEXITSTATUS(status);
+			if (rc) {
+				notice_msg("%s/%u:%u: "
+					   "job handler %d exited, status=%d",
+					   caller_user, caller_uid, caller_num,
+					   pid, rc);
+			} else {
+				info_msg("%s/%u:%u: job handler %d exited",
+					 caller_user, caller_uid, caller_num,
+					 pid);
+				++n_valid;
+			}
+		} else if (WIFSIGNALED(status)) {
+			notice_msg("%s/%u:%u: "
+				   "job handler %d terminated by signal %d",
+				   caller_user, caller_uid, caller_num,
+				   pid, WTERMSIG(status));
+		}
+	}
+
+	return n_valid;
+}
+
 void
 caller_server(struct hadaemon *sdae)
 {
 	unsigned long n_seconds = 0;
 	int finish_server = 0;
 
-	/*
-	 * As we are not going to handle SIGCHLD, unblock it.
-	 */
-	block_signal_handler(SIGCHLD, SIG_UNBLOCK);
-
 	while (!finish_server) {
 		errno = 0;
 		struct epoll_event ev[16];
@@ -135,7 +321,15 @@ caller_server(struct hadaemon *sdae)
 		}
 
 		if (fdcount == 0) {
-			if (++n_seconds >= server_session_timeout)
+			/* Job cgroups are removed after their runners exit. */
+			remove_stale_job_cgroups();
+
+			/*
+			 * The session is not inactive
+			 * while its job requests are being handled.
+			 */
+			if (!n_handlers &&
+			    ++n_seconds >= server_session_timeout)
 				break;
 			continue;
 		}
@@ -168,6 +362,12 @@ caller_server(struct hadaemon *sdae)
 				case SIGTERM:
 					finish_server = 1;
 					break;
+				case SIGCHLD:
+					if (wait_job_handlers())
+						n_seconds = 0;
+					update_accepting(sdae);
+					netns_pool_refill();
+					break;
 				default:
 					error_msg("unexpected signal %d ignored",
 						  fdsi.ssi_signo);
@@ -177,6 +377,15 @@ caller_server(struct hadaemon *sdae)
 			}
 		}
 		for (int i = 0; !finish_server && i < fdcount; ++i) {
+			if ((ev[i].events & EPOLLIN) &&
+			    ev[i].data.fd == config_watch_fd &&
+			    config_watch_changed(config_watch_fd))
+				reconfigure_session();
+		}
+		for (int i = 0; !finish_server && i < fdcount; ++i) {
+			if (killuid_handle_event(sdae->fd_ep, ev[i].data.fd))
+				continue;
+
 			if (!(ev[i].events & EPOLLIN))
 				continue;
 
@@ -188,10 +397,20 @@ caller_server(struct hadaemon *sdae)
 				}
 
 				if (set_recv_timeout(conn, 3) == 0 &&
-				    check_peer_creds(conn) == 0 &&
-				    spawn_job_request_handler(sdae, conn) == 0) {
-					/* reset timer */
-					n_seconds = 0;
+				    check_peer_creds(conn) == 0) {
+					refresh_user_groups();
+					killuid_prepare_job();
+					pid_t pid =
+						spawn_job_request_handler(sdae,
+									  conn);
+					killuid_track_job(sdae->fd_ep, pid);
+					if (pid > 0) {
+						add_job_handler(pid);
+						update_accepting(sdae);
+					} else if (pid == 0) {
+						/* reset timer */
+						n_seconds = 0;
+					}
 				}
 
 				xclose(&conn);
@@ -199,6 +418,8 @@ caller_server(struct hadaemon *sdae)
 		}
 	}
 
+	remove_stale_job_cgroups();
+
 	notice_msg("%s/%u:%u: session finished",
 		   caller_user, caller_uid, caller_num);
 	exit(EXIT_SUCCESS);
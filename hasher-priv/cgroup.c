@@ -11,13 +11,16 @@
 
 #include "caller_data.h"
 #include "cgroup.h"
+#include "change_cgroup.h"
 #include "error_prints.h"
 #include "fds.h"
 #include "io_loop.h"
 #include "logging.h"
-#include "procfd.h"
+#include "server_config.h"
 #include "xmalloc.h"
 
+#include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdio.h>
@@ -25,50 +28,54 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 
-static void
-join_cgroup(const char *cgroup_path) {
-	char *fname = xasprintf("%s/%s/%s", "/sys/fs/cgroup",
-				cgroup_path, "cgroup.procs");
-	int fd = open(fname, O_WRONLY | O_CLOEXEC);
-	if (fd < 0)
-		perror_msg_and_die("open: %s", fname);
-
-	debug_msg("joining %s", cgroup_path);
-
-	if (dprintf(fd, "%d\n", getpid()) < 0)
-		perror_msg_and_die("dprintf: %s", fname);
-
-	if (xclose(&fd) < 0)
-		perror_msg_and_die("close: %s", fname);
-
-	free(fname);
-}
-
-void
-join_caller_cgroup(pid_t pid)
+/*
+ * Obtains the cgroup v2 path of the client process relative to
+ * /sys/fs/cgroup, or NULL if it has none.
+ * Returns 0 on success, -1 on error.
+ */
+static int
+get_caller_cgroup(pid_t pid, char **path)
 {
-	int proc_fd = open_proc_fd(pid, caller_uid);
+	*path = NULL;
 
-	static const char cgroup_name[] = "cgroup";
-	int cgroup_fd = openat(proc_fd, cgroup_name, O_RDONLY | O_CLOEXEC);
-	if (cgroup_fd < 0)
-		perror_msg_and_die("open: %s", cgroup_name);
+	char *fname = xasprintf("/proc/%u/cgroup", (unsigned int) pid);
+	int cgroup_fd = open(fname, O_RDONLY | O_CLOEXEC);
+	if (cgroup_fd < 0) {
+		perror_msg("open: %s", fname);
+		free(fname);
+		return -1;
+	}
 
 	static const char prefix[] = "0::";
 	enum { prefix_len = sizeof(prefix) - 1 };
 	char line[PATH_MAX + prefix_len];
+	struct stat st;
+	int rc = -1;
 
-	ssize_t sz = read_loop(cgroup_fd, line, sizeof(line) - 1);
-	if (sz < 0)
-		perror_msg_and_die("read: %s", cgroup_name);
+	/* Check that the file belongs to the client.  */
+	if (fstat(cgroup_fd, &st)) {
+		perror_msg("fstat: %s", fname);
+		goto out;
+	}
+	if (st.st_uid != caller_uid) {
+		error_msg("%s: expected owner %u, found owner %u",
+			  fname, caller_uid, st.st_uid);
+		goto out;
+	}
 
-	xclose(&cgroup_fd);
-	xclose(&proc_fd);
+	ssize_t sz = read_loop(cgroup_fd, line, sizeof(line) - 1);
+	if (sz < 0) {
+		perror_msg("read: %s", fname);
+		goto out;
+	}
 
 	if (sz == 0) {
-		debug_msg("%s file is empty", cgroup_name);
-		return;
+		debug_msg("%s file is empty", fname);
+		rc = 0;
+		goto out;
 	}
 
 	switch (line[sz - 1]) {
@@ -82,8 +89,387 @@ join_caller_cgroup(pid_t pid)
 			break;
 	}
 
-	if (strncmp(line, prefix, prefix_len))
-		error_msg_and_die("%s: not version 2", cgroup_name);
+	if (strncmp(line, prefix, prefix_len)) {
+		error_msg("%s: not version 2", fname);
+		goto out;
+	}
+
+	*path = xstrdup(&line[prefix_len]);
+	rc = 0;
+
+out:
+	(void) xclose(&cgroup_fd);
+	free(fname);
+	return rc;
+}
+
+/*
+ * Opens the cgroup of the client process, storing its descriptor
+ * in *fd, or -1 if the client has no cgroup.
+ * Returns 0 on success, -1 on error.
+ */
+int
+open_caller_cgroup(pid_t pid, int *fd)
+{
+	char *path;
+
+	*fd = -1;
+	if (get_caller_cgroup(pid, &path) < 0)
+		return -1;
+	if (!path)
+		return 0;
+
+	char *fname = xasprintf("%s/%s", "/sys/fs/cgroup", path);
+	*fd = open(fname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (*fd < 0)
+		perror_msg("open: %s", fname);
+
+	free(fname);
+	free(path);
+	return *fd < 0 ? -1 : 0;
+}
+
+static const char job_cgroup_prefix[] = "hasher-priv-job.";
+
+int
+need_job_cgroup(void)
+{
+	for (const change_cgroup_t *p = change_cgroup; p->name; ++p)
+		if (p->value)
+			return 1;
+	return 0;
+}
+
+static int
+write_cgroup_file(int dir_fd, const char *name, const char *value)
+{
+	int fd = openat(dir_fd, name, O_WRONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	size_t len = strlen(value);
+	ssize_t rc = write(fd, value, len);
+	int saved_errno = errno;
+	(void) xclose(&fd);
+	errno = saved_errno;
+
+	return rc == (ssize_t) len ? 0 : -1;
+}
+
+/*
+ * Opens the named file of the given cgroup as a stream, or returns NULL
+ * if the file is not available, e.g. because the controller is disabled.
+ */
+static FILE *
+fopen_cgroup_file(int dir_fd, const char *name)
+{
+	int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	FILE *fp = fdopen(fd, "r");
+	if (!fp)
+		(void) xclose(&fd);
+	return fp;
+}
+
+/*
+ * Opens the cgroup under which job cgroups are created,
+ * or returns -1 on error.
+ */
+static int
+open_job_cgroup_parent(void)
+{
+	if (!server_job_cgroup_parent) {
+		error_msg("cannot apply cgroup limits: %s is not set",
+			  "job_cgroup_parent");
+		return -1;
+	}
+
+	char *fname = xasprintf("%s/%s", "/sys/fs/cgroup",
+				server_job_cgroup_parent);
+	int fd = open(fname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		perror_msg("open: %s", fname);
+
+	free(fname);
+	return fd;
+}
+
+/*
+ * Returns 1 if the given cgroup has processes of its own,
+ * 0 if it has none, or -1 on error.
+ */
+static int
+cgroup_has_processes(int dir_fd)
+{
+	FILE *fp = fopen_cgroup_file(dir_fd, "cgroup.procs");
+	if (!fp) {
+		perror_msg("open: %s", "cgroup.procs");
+		return -1;
+	}
+
+	int c = fgetc(fp);
+	fclose(fp);
+	return c != EOF;
+}
+
+/*
+ * Enable the controllers required by configured limits
+ * for the children of the given cgroup.  As the cgroup v2 does not allow
+ * this in a cgroup that has processes of its own, refuse to try.
+ */
+static int
+enable_cgroup_controllers(int dir_fd)
+{
+	int rc = cgroup_has_processes(dir_fd);
+	if (rc) {
+		if (rc > 0)
+			error_msg("%s: cgroup has processes of its own",
+				  server_job_cgroup_parent);
+		return -1;
+	}
+
+	for (const change_cgroup_t *p = change_cgroup; p->name; ++p) {
+		if (!p->value)
+			continue;
+
+		char *ctl = xasprintf("+%s", p->controller);
+		rc = write_cgroup_file(dir_fd, "cgroup.subtree_control", ctl);
+		if (rc < 0)
+			perror_msg("cannot enable %s controller",
+				   p->controller);
+		free(ctl);
+		if (rc < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Remove job cgroups left behind by jobs that have already finished.
+ * The runner of a job holds a lock on the descriptor of its job cgroup
+ * as long as it needs the cgroup, so cgroups that are locked are in use.
+ * Cgroups that still have processes cannot be removed, and stay.
+ */
+static void
+remove_job_cgroups(int dir_fd)
+{
+	int fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	DIR *dir = fdopendir(fd);
+	if (!dir) {
+		(void) xclose(&fd);
+		return;
+	}
+
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		if (ent->d_type != DT_DIR ||
+		    strncmp(ent->d_name, job_cgroup_prefix,
+			    sizeof(job_cgroup_prefix) - 1))
+			continue;
+
+		int job_fd = openat(dir_fd, ent->d_name,
+				    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (job_fd < 0)
+			continue;
+
+		if (!flock(job_fd, LOCK_EX | LOCK_NB) &&
+		    !unlinkat(dir_fd, ent->d_name, AT_REMOVEDIR))
+			debug_msg("removed stale cgroup %s", ent->d_name);
+
+		(void) xclose(&job_fd);
+	}
+
+	closedir(dir);
+}
+
+void
+remove_stale_job_cgroups(void)
+{
+	if (!server_job_cgroup_parent)
+		return;
+
+	char *fname = xasprintf("%s/%s", "/sys/fs/cgroup",
+				server_job_cgroup_parent);
+	int fd = open(fname, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	free(fname);
+	if (fd < 0)
+		return;
+
+	remove_job_cgroups(fd);
+	(void) xclose(&fd);
+}
+
+/*
+ * Creates a cgroup for a chrootuid job under job_cgroup_parent,
+ * applies configured limits to it, and returns a locked descriptor of it,
+ * or -1 on error.
+ */
+int
+open_job_cgroup(void)
+{
+	int parent_fd = open_job_cgroup_parent();
+	if (parent_fd < 0)
+		return -1;
+
+	remove_job_cgroups(parent_fd);
+
+	int fd = -1;
+	char *name = NULL;
+
+	if (enable_cgroup_controllers(parent_fd) < 0)
+		goto out;
+
+	for (unsigned int i = 0; fd < 0; ++i) {
+		free(name);
+		name = xasprintf("%s%u.%u.%d.%u", job_cgroup_prefix,
+				 caller_uid, caller_num, (int) getpid(), i);
+
+		if (mkdirat(parent_fd, name, 0755)) {
+			if (errno == EEXIST)
+				continue;
+			perror_msg("mkdir: %s", name);
+			goto out;
+		}
+
+		fd = openat(parent_fd, name,
+			    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0) {
+			if (errno == ENOENT)
+				continue;
+			perror_msg("open: %s", name);
+			goto out;
+		}
 
-	join_cgroup(&line[prefix_len]);
+		/*
+		 * Lock the new cgroup against removal, unless it has
+		 * already been removed as a stale one in the meantime.
+		 */
+		if (flock(fd, LOCK_EX)) {
+			perror_msg("flock: %s", name);
+			goto fail;
+		}
+		if (faccessat(fd, "cgroup.procs", F_OK, 0))
+			(void) xclose(&fd);
+	}
+
+	for (const change_cgroup_t *p = change_cgroup; p->name; ++p) {
+		if (!p->value)
+			continue;
+		if (write_cgroup_file(fd, p->file, p->value) < 0) {
+			perror_msg("cannot set %s to \"%s\"",
+				   p->file, p->value);
+			goto fail;
+		}
+		debug_msg("%s: %s=%s", name, p->file, p->value);
+	}
+
+	/*
+	 * Make the OOM killer take down the whole job at once
+	 * instead of leaving a half-dead build behind.
+	 */
+	if (write_cgroup_file(fd, "memory.oom.group", "1") < 0 &&
+	    errno != ENOENT) {
+		perror_msg("cannot set %s", "memory.oom.group");
+		goto fail;
+	}
+
+	goto out;
+
+fail:
+	(void) xclose(&fd);
+	(void) unlinkat(parent_fd, name, AT_REMOVEDIR);
+out:
+	free(name);
+	(void) xclose(&parent_fd);
+	return fd;
+}
+
+void
+join_cgroup_fd(int cgroup_fd)
+{
+	debug_msg("joining cgroup by descriptor");
+
+	char *pid = xasprintf("%d\n", (int) getpid());
+	if (write_cgroup_file(cgroup_fd, "cgroup.procs", pid) < 0)
+		perror_msg_and_die("write: %s", "cgroup.procs");
+	free(pid);
+}
+
+/* Freezes or thaws all processes of the given cgroup. */
+int
+freeze_cgroup_fd(int cgroup_fd, int freeze)
+{
+	if (write_cgroup_file(cgroup_fd, "cgroup.freeze",
+			      freeze ? "1" : "0") < 0) {
+		perror_msg("write: %s", "cgroup.freeze");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Kills all processes of the given cgroup. */
+int
+kill_cgroup_fd(int cgroup_fd)
+{
+	if (write_cgroup_file(cgroup_fd, "cgroup.kill", "1") < 0) {
+		if (errno != ENOENT)
+			perror_msg("write: %s", "cgroup.kill");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Fills the fields of the job usage that are provided by the cgroup:
+ * CPU times from cpu.stat, peak memory usage from memory.peak,
+ * and I/O bytes from io.stat summed over all devices.
+ * The fields that the cgroup does not provide are left intact.
+ */
+void
+read_cgroup_usage(int cgroup_fd, job_usage_t *usage)
+{
+	char key[64];
+	unsigned long long val;
+	FILE *fp;
+
+	if ((fp = fopen_cgroup_file(cgroup_fd, "cpu.stat"))) {
+		while (fscanf(fp, "%63s %llu", key, &val) == 2) {
+			if (!strcmp(key, "user_usec"))
+				usage->user_usec = val;
+			else if (!strcmp(key, "system_usec"))
+				usage->system_usec = val;
+		}
+		fclose(fp);
+	}
+
+	if ((fp = fopen_cgroup_file(cgroup_fd, "memory.peak"))) {
+		if (fscanf(fp, "%llu", &val) == 1)
+			usage->memory_peak = val;
+		fclose(fp);
+	}
+
+	if ((fp = fopen_cgroup_file(cgroup_fd, "io.stat"))) {
+		unsigned long long rbytes = 0, wbytes = 0;
+		char line[BUFSIZ];
+
+		while (fgets(line, sizeof(line), fp)) {
+			const char *p;
+
+			if ((p = strstr(line, " rbytes=")))
+				rbytes += strtoull(p + 8, 0, 10);
+			if ((p = strstr(line, " wbytes=")))
+				wbytes += strtoull(p + 8, 0, 10);
+		}
+		fclose(fp);
+
+		usage->bytes_read = rbytes;
+		usage->bytes_written = wbytes;
+	}
 }
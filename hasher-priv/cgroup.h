@@ -10,8 +10,16 @@
 #ifndef HASHER_CGROUP_H
 # define HASHER_CGROUP_H
 
+# include "communication.h"
 # include <sys/types.h>
 
-void join_caller_cgroup(pid_t client_pid);
+int open_caller_cgroup(pid_t client_pid, int *fd);
+int need_job_cgroup(void);
+int open_job_cgroup(void);
+void remove_stale_job_cgroups(void);
+void join_cgroup_fd(int cgroup_fd);
+int freeze_cgroup_fd(int cgroup_fd, int freeze);
+int kill_cgroup_fd(int cgroup_fd);
+void read_cgroup_usage(int cgroup_fd, job_usage_t *);
 
 #endif /* HASHER_CGROUP_H */
@@ -0,0 +1,23 @@
+/*
+ * The per-job cgroup limits interface for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_CHANGE_CGROUP_H
+# define HASHER_CHANGE_CGROUP_H
+
+typedef struct
+{
+	const char *name;
+	const char *controller;
+	const char *file;
+	char   *value;
+} change_cgroup_t;
+
+extern change_cgroup_t change_cgroup[];
+
+#endif /* !HASHER_CHANGE_CGROUP_H */
@@ -12,6 +12,7 @@
 #include "caller_data.h"
 #include "chdir.h"
 #include "error_prints.h"
+#include "fds.h"
 #include "xmalloc.h"
 #include <errno.h>
 #include <fcntl.h>
@@ -20,6 +21,35 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef RESOLVE_NO_MAGICLINKS
+# define RESOLVE_NO_MAGICLINKS	0x02
+# define RESOLVE_NO_SYMLINKS	0x04
+# define RESOLVE_BENEATH	0x08
+#endif
+
+/* Layout of struct open_how, see openat2(2). */
+struct open_how_v0 {
+	unsigned long long flags;
+	unsigned long long mode;
+	unsigned long long resolve;
+};
+
+/*
+ * openat2 is called via syscall(2) because not all supported versions
+ * of libc provide a wrapper for it.
+ */
+static int
+sys_openat2(int dirfd, const char *path, struct open_how_v0 *how)
+{
+#ifdef __NR_openat2
+	return (int) syscall(__NR_openat2, dirfd, path, how, sizeof(*how));
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
 
 /* This function may be executed with root privileges. */
 static const char *
@@ -72,10 +102,70 @@ safe_chdir_component(const char *name, VALIDATE_FPTR validator)
 				  name, what);
 }
 
+/*
+ * Change the current working directory to the given relative path
+ * using openat2+fstat+validate technique for each path element and
+ * fchdir to the last one.  Every element is resolved beneath the
+ * descriptor of the previous one, which has already been validated,
+ * and the resolution fails if it escapes that directory or encounters
+ * a symlink, so no element can be swapped after its validation.
+ * Returns 0 on success, or -1 if the kernel does not support openat2.
+ *
+ * This function may be executed with root privileges.
+ */
+int
+safe_chdir_beneath(const char *path, VALIDATE_FPTR validator)
+{
+	struct open_how_v0 how = {
+		.flags = O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC,
+		.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS |
+			   RESOLVE_NO_MAGICLINKS
+	};
+	int dir_fd = AT_FDCWD;
+	int rc = 0;
+	char *p = xstrdup(path);
+
+	for (char *elem = strtok(p, "/"); elem; elem = strtok(0, "/")) {
+		int fd = sys_openat2(dir_fd, elem, &how);
+
+		if (fd < 0) {
+			/*
+			 * EAGAIN means a concurrent rename, let the walk
+			 * handle it; nothing has been changed so far.
+			 */
+			if (errno == ENOSYS || errno == E2BIG ||
+			    errno == EAGAIN) {
+				rc = -1;
+				break;
+			}
+			perror_msg_and_die("openat2: %s", elem);
+		}
+
+		if (dir_fd >= 0)
+			xclose(&dir_fd);
+		dir_fd = fd;
+
+		struct stat st;
+		if (fstat(dir_fd, &st) < 0)
+			perror_msg_and_die("fstat: %s", elem);
+
+		validator(&st, elem);
+	}
+
+	if (!rc && dir_fd >= 0 && fchdir(dir_fd) < 0)
+		perror_msg_and_die("fchdir: %s", path);
+
+	if (dir_fd >= 0)
+		xclose(&dir_fd);
+	free(p);
+	return rc;
+}
+
 /*
  * Change the current working directory using
  * lstat+validate+chdir+lstat+compare technique.
- * If the path is relative, chdir to each path element sequentially.
+ * If the path is relative, chdir to each path element sequentially,
+ * unless it can be resolved at once by safe_chdir_beneath().
  *
  * This function may be executed with root privileges.
  */
@@ -84,7 +174,7 @@ safe_chdir(const char *path, VALIDATE_FPTR validator)
 {
 	if (path[0] == '/' || !strchr(path, '/'))
 		safe_chdir_component(path, validator);
-	else {
+	else if (safe_chdir_beneath(path, validator) < 0) {
 		char *p = xstrdup(path);
 		for (char *elem = strtok(p, "/"); elem; elem = strtok(0, "/"))
 			safe_chdir_component(elem, validator);
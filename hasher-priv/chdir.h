@@ -20,6 +20,7 @@ void stat_caller_rooter_ok_validator(struct stat *, const char *);
 void stat_root_ok_validator(struct stat *, const char *);
 
 void safe_chdir(const char *, VALIDATE_FPTR);
+int safe_chdir_beneath(const char *, VALIDATE_FPTR);
 void safe_fchdir(int, VALIDATE_FPTR);
 void chdiruid(const char *, VALIDATE_FPTR);
 void fchdiruid(int, VALIDATE_FPTR);
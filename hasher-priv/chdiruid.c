@@ -13,12 +13,19 @@
 #include "chdir.h"
 #include "chid.h"
 #include "error_prints.h"
+#include "user_groups.h"
 #include "xmalloc.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <grp.h>
+#include <sys/stat.h>
+
+/* The last working directory that passed check_cwd(). */
+static dev_t checked_cwd_dev;
+static ino_t checked_cwd_ino;
+static int checked_cwd_valid;
 
 /*
  * Check whether the file path PREFIX is prefix of the file path SAMPLE.
@@ -64,6 +71,28 @@ check_cwd(void)
 	}
 
 	free(cwd);
+
+	struct stat st;
+	if (stat(".", &st) == 0) {
+		checked_cwd_dev = st.st_dev;
+		checked_cwd_ino = st.st_ino;
+		checked_cwd_valid = 1;
+	}
+}
+
+/*
+ * Check whether the current working directory has already passed
+ * check_cwd(), so that there is no need to build its path again.
+ *
+ * This function may be executed with caller privileges.
+ */
+static int
+is_checked_cwd(void)
+{
+	struct stat st;
+
+	return checked_cwd_valid && stat(".", &st) == 0 &&
+	       st.st_dev == checked_cwd_dev && st.st_ino == checked_cwd_ino;
 }
 
 /*
@@ -77,9 +106,11 @@ change_creds(uid_t *saved_uid, gid_t *saved_gid)
 	*saved_uid = (uid_t) -1;
 	*saved_gid = (gid_t) -1;
 #ifdef ENABLE_SUPPLEMENTARY_GROUPS
-	if (initgroups(caller_user, caller_gid) < 0)
-		perror_msg_and_die("initgroups(%s, %u)",
-				   caller_user, caller_gid);
+	size_t ngroups;
+	const gid_t *groups = get_user_groups(caller_user, caller_gid,
+					      &ngroups);
+	if (setgroups(ngroups, groups) < 0)
+		perror_msg_and_die("setgroups");
 #endif /* ENABLE_SUPPLEMENTARY_GROUPS */
 	ch_gid(caller_gid, saved_gid);
 	ch_uid(caller_uid, saved_uid);
@@ -104,8 +135,12 @@ restore_creds(uid_t saved_uid, gid_t saved_gid)
 /*
  * Change the current working directory to the given path.
  * Temporary change credentials to caller_user during this operation.
- * If the path is relative, chdir to each path element sequentially.
- * If chroot prefix path is set, ensure that it matches given path.
+ * If the path is relative, resolve it beneath the current directory
+ * at once, or if that is not supported, chdir to each path element
+ * sequentially.
+ * If chroot prefix path is set, ensure that it matches given path,
+ * which is implied if the path has been resolved beneath the current
+ * directory that has already been checked.
  *
  * This function may be executed with root privileges.
  */
@@ -121,17 +156,25 @@ chdiruid(const char *path, VALIDATE_FPTR validator)
 	change_creds(&saved_uid, &saved_gid);
 
 	/* Change and verify directory. */
-	if (path[0] == '/' || !strchr(path, '/')) {
+	int checked = 0;
+	if (path[0] == '/') {
 		safe_chdir(path, validator);
 	} else {
-		char *p = xstrdup(path);
-		for (char *elem = strtok(p, "/"); elem; elem = strtok(0, "/"))
-			safe_chdir(elem, validator);
-		free(p);
+		int was_checked = is_checked_cwd();
+		if (safe_chdir_beneath(path, validator) == 0) {
+			checked = was_checked;
+		} else {
+			char *p = xstrdup(path);
+			for (char *elem = strtok(p, "/"); elem;
+			     elem = strtok(0, "/"))
+				safe_chdir(elem, validator);
+			free(p);
+		}
 	}
 
 	/* Check the current working directory against the chroot prefix path. */
-	check_cwd();
+	if (!checked)
+		check_cwd();
 
 	/* Restore credentials. */
 	restore_creds(saved_uid, saved_gid);
@@ -159,7 +202,8 @@ fchdiruid(int fd, VALIDATE_FPTR validator)
 	safe_fchdir(fd, validator);
 
 	/* Check the current working directory against the chroot prefix path. */
-	check_cwd();
+	if (!is_checked_cwd())
+		check_cwd();
 
 	/* Restore credentials. */
 	restore_creds(saved_uid, saved_gid);
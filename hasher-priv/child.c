@@ -11,6 +11,7 @@
 
 #include "caller_config.h"
 #include "child.h"
+#include "cpu_alloc.h"
 #include "error_prints.h"
 #include "fds.h"
 #include "io_loop.h"
@@ -173,6 +174,11 @@ set_affinity_nproc(size_t nproc)
 
 	if (!nproc)
 		return 0;
+
+	/* Use the CPUs allocated for the job by the runner, if any. */
+	int rc = setup_job_cpus(numa_bind);
+	if (rc)
+		return rc < 0 ? -1 : 0;
 	if (sched_getaffinity(0, sizeof(cpu_set_t), &set) == -1)
 		return -1;
 	cpucount = (size_t) CPU_COUNT(&set);
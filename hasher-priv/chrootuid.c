@@ -17,13 +17,18 @@
 #include "error_prints.h"
 #include "executors.h"
 #include "fds.h"
+#include "jobserver.h"
 #include "mount.h"
+#include "mount_ns.h"
 #include "ns.h"
 #include "parent.h"
+#include "perf_counters.h"
 #include "pty.h"
 #include "signals.h"
+#include "pidns_init.h"
 #include "spawn_killuid.h"
 #include "unshare.h"
+#include "user_groups.h"
 #include "x11.h"
 #include "xmalloc.h"
 #include <errno.h>
@@ -80,27 +85,16 @@ chrootuid(uid_t uid, gid_t gid, const unsigned int persona,
 	int     ctl[2] = { -1, -1 };
 	pid_t   pid;
 
-	spawn_killuid();
+	/* Unless the session server has already done it. */
+	if (!killuid_done)
+		spawn_killuid();
 
 	/*
 	 * Obtain the supplementary group access list for the target user,
 	 * clear the current supplementary group access list.
 	 */
-	int ngroups;
-	gid_t *groups = NULL;
-
-	if (initgroups(user_name, gid) != 0)
-	    perror_msg_and_die("initgroups");
-
-	if ((ngroups = getgroups(0, NULL)) == -1)
-	    perror_msg_and_die("getgroups");
-
-	if (ngroups > 0) {
-	    groups = (gid_t *)xcalloc((size_t)ngroups, sizeof(gid_t));
-
-	    if ((ngroups = getgroups(ngroups, groups)) == -1)
-		perror_msg_and_die("getgroups");
-	}
+	size_t ngroups;
+	const gid_t *groups = get_user_groups(user_name, gid, &ngroups);
 
 	if (setgroups(0UL, 0) < 0)
 		perror_msg_and_die("setgroups");
@@ -110,11 +104,12 @@ chrootuid(uid_t uid, gid_t gid, const unsigned int persona,
 
 	/*
 	 * chdir to the chroot directory,
-	 * unshare the mount namespace,
+	 * set up a private mount namespace for it,
 	 * reopen the chroot directory in the new mount namespace.
 	 */
 	fchdiruid(chroot_fd, stat_caller_ok_validator);
-	unshare_mount();
+	setup_mount_ns();
+	xclose(&chroot_fd);
 	chroot_fd = open(".", O_RDONLY);
 	if (chroot_fd < 0)
 		perror_msg_and_die("open: .");
@@ -146,11 +141,13 @@ chrootuid(uid_t uid, gid_t gid, const unsigned int persona,
 	if (!share_caller_network)
 		unshare_network();
 
+	/* The child becomes the init of the PID namespace, if any. */
+	int own_pid_ns = unshare_pid() == 0;
+
 	/* Always create pty, necessary for ioctl TIOCSCTTY in the child. */
 	master = open_pty(&slave, OPEN_PTY_UNCHROOTED, OPEN_PTY_VERBOSE);
 
-	if (chroot(".") < 0)
-		perror_msg_and_die("chroot");
+	enter_chroot();
 
 	/* Try to create another pty inside chroot. */
 	{
@@ -175,6 +172,9 @@ chrootuid(uid_t uid, gid_t gid, const unsigned int persona,
 
 	block_signal_handler(SIGCHLD, SIG_BLOCK);
 
+	/* Count the whole process tree of the job if requested. */
+	open_perf_counters();
+
 	if ((pid = fork()) < 0)
 		perror_msg_and_die("fork");
 
@@ -184,7 +184,8 @@ chrootuid(uid_t uid, gid_t gid, const unsigned int persona,
 			xasprintf("%s: %s",
 				  program_invocation_short_name, "parent");
 
-		free(groups);
+		/* The network namespace is entered by the child, if at all. */
+		xclose(&netns_fd);
 
 		if (xclose(&slave)
 		    || (!use_pty
@@ -207,8 +208,10 @@ chrootuid(uid_t uid, gid_t gid, const unsigned int persona,
 
 		/* Process is no longer privileged at this point. */
 
-		return handle_parent(pid, master, pipe_out[0], pipe_err[0],
-				     ctl[0]);
+		int rc = handle_parent(pid, master, pipe_out[0], pipe_err[0],
+				       ctl[0]);
+		collect_perf_counters();
+		return rc;
 	} else
 	{
 		program_invocation_short_name =
@@ -231,8 +234,11 @@ chrootuid(uid_t uid, gid_t gid, const unsigned int persona,
 		if (prctl(PR_SET_DUMPABLE, 0))
 			perror_msg_and_die("prctl PR_SET_DUMPABLE");
 
-		setgroups((size_t) ngroups, groups);
-		free(groups);
+		/* Only the job process returns. */
+		if (own_pid_ns)
+			pidns_init(uid, gid);
+
+		setgroups(ngroups, groups);
 
 		if (setgid(gid) < 0)
 			perror_msg_and_die("setgid");
@@ -258,9 +264,12 @@ chrootuid(uid_t uid, gid_t gid, const unsigned int persona,
 		}
 
 		char   *term_env = xasprintf("TERM=%s", term ? : "dumb");
+		char   *make_env = jobserver_child_env();
 		const char *x11_env = x11_display ? "DISPLAY=:10.0" : 0;
 		const char *const env[] = {
-			ehome, euser, epath, term_env, x11_env, 0
+			ehome, euser, epath, term_env,
+			make_env ? make_env : x11_env,
+			make_env ? x11_env : 0, 0
 		};
 
 		handle_child(argv, env, slave,
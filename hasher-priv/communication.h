@@ -31,11 +31,16 @@ typedef enum {
 	CMD_JOB_CHROOT_FD	= 1U << 5,
 	CMD_JOB_PERSONALITY	= 1U << 6,
 	CMD_JOB_RUN		= 1U << 7,
+
+	/* job service command of protocol version 2 */
+	CMD_JOB_SUBMIT		= 1U << 8,
 } cmd_enum_t;
 
 enum {
 	CMD_STATUS_DONE = 0,
 	CMD_STATUS_FAILED = -1,
+	CMD_STATUS_QUEUED = -2,
+	CMD_STATUS_ANSWER = -3,
 };
 
 typedef enum {
@@ -53,9 +58,78 @@ typedef struct {
 	unsigned int len;
 } cmd_header_t;
 
+/*
+ * Protocol version 2 describes the whole job in a single CMD_JOB_SUBMIT
+ * message: cmd_header_t is followed by job_submit_t, then by args_len
+ * bytes of NUL-terminated arguments and env_len bytes of NUL-terminated
+ * environment strings, hdr.len being the total size of this payload.
+ * The descriptors (stdin, stdout, stderr, and, for chrootuid jobs,
+ * the chroot directory, optionally followed by a file system image
+ * if JOB_SUBMIT_IMAGE is set in flags) are passed as SCM_RIGHTS
+ * attached to the header.
+ * The server answers once, when the job is completed.
+ * If JOB_SUBMIT_QUEUE is set in flags, the server may also answer
+ * with CMD_STATUS_QUEUED and a message describing the queue position
+ * of the job, any number of times while the job waits for a free slot.
+ * If JOB_SUBMIT_ANSWER is set in flags of a getconf, getugid1, or getugid2
+ * job, the server may answer the query itself with CMD_STATUS_ANSWER,
+ * the message being the answer to be written to stdout by the client;
+ * the job is completed successfully then.
+ */
+#define JOB_PROTO_VERSION	2
+#define JOB_SUBMIT_MAX_FDS	5
+
+#define JOB_SUBMIT_IMAGE	(1U << 0)
+#define JOB_SUBMIT_USAGE	(1U << 1)
+#define JOB_SUBMIT_PERF		(1U << 2)
+#define JOB_SUBMIT_QUEUE	(1U << 3)
+#define JOB_SUBMIT_ANSWER	(1U << 4)
+
+typedef struct {
+	unsigned int version;
+	job_enum_t   type;
+	unsigned int persona;
+	unsigned int n_fds;
+	unsigned int args_len;
+	unsigned int env_len;
+	unsigned int flags;
+} job_submit_t;
+
 typedef struct {
         int rc;
         unsigned int len;
 } srv_cmd_resp_t;
 
+/*
+ * If JOB_SUBMIT_USAGE is set in flags of a job, and the job has completed,
+ * the response carrying its exit status is followed by job_usage_t
+ * describing the resources the job has consumed; a CMD_STATUS_FAILED
+ * response is never followed by it.  Fields that could not be obtained
+ * are zero.
+ * If the job ran in a job cgroup, CPU times and I/O bytes cover all
+ * processes of the job, otherwise they cover only the processes that
+ * have been waited for.
+ */
+typedef struct {
+	unsigned long long wall_usec;
+	unsigned long long user_usec;
+	unsigned long long system_usec;
+	unsigned long long max_rss;	/* of the largest process, in bytes */
+	unsigned long long memory_peak;	/* of the job cgroup, in bytes */
+	unsigned long long minor_faults;
+	unsigned long long major_faults;
+	unsigned long long voluntary_switches;
+	unsigned long long involuntary_switches;
+	unsigned long long blocks_read;
+	unsigned long long blocks_written;
+	unsigned long long bytes_read;
+	unsigned long long bytes_written;
+	/* Performance counters, if JOB_SUBMIT_PERF is also set. */
+	unsigned long long instructions;
+	unsigned long long cycles;
+	unsigned long long cache_misses;
+	unsigned long long branch_misses;
+	unsigned long long task_clock_nsec;
+} job_usage_t;
+
 #endif /* HASHER_COMMUNICATION_H_ */
@@ -0,0 +1,79 @@
+/*
+ * The configuration watch for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root privileges. */
+
+#include "config_watch.h"
+#include "error_prints.h"
+#include "fds.h"
+#include "macros.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+static const char *const watched_dirs[] = {
+	"/etc/hasher-priv",
+	"/etc/hasher-priv/user.d",
+};
+
+#define WATCH_MASK (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | \
+		    IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVED_TO | \
+		    IN_MOVE_SELF)
+
+/*
+ * Returns an inotify descriptor that becomes readable when anything
+ * changes in the configuration directories, or -1 on failure.
+ */
+int
+config_watch_init(void)
+{
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		perror_msg("inotify_init1");
+		return -1;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(watched_dirs); ++i) {
+		if (inotify_add_watch(fd, watched_dirs[i], WATCH_MASK) < 0) {
+			perror_msg("inotify_add_watch: %s", watched_dirs[i]);
+			xclose(&fd);
+			return -1;
+		}
+	}
+
+	return fd;
+}
+
+/*
+ * Consumes all pending events of the inotify descriptor.
+ * Returns nonzero if there were any.
+ */
+int
+config_watch_changed(int fd)
+{
+	char buf[4096]
+		__attribute__((__aligned__(__alignof__(struct inotify_event))));
+	int changed = 0;
+
+	for (;;) {
+		ssize_t len = read(fd, buf, sizeof(buf));
+		if (len > 0) {
+			changed = 1;
+			continue;
+		}
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && errno != EAGAIN)
+			perror_msg("read: inotify");
+		break;
+	}
+
+	return changed;
+}
@@ -0,0 +1,16 @@
+/*
+ * The configuration watch interface for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_CONFIG_WATCH_H
+# define HASHER_CONFIG_WATCH_H
+
+int config_watch_init(void);
+int config_watch_changed(int fd);
+
+#endif /* !HASHER_CONFIG_WATCH_H */
@@ -0,0 +1,380 @@
+/*
+ * The CPU allocator for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root or caller privileges. */
+
+#include "cpu_alloc.h"
+#include "error_prints.h"
+#include "fds.h"
+#include "logging.h"
+#include "xmalloc.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_BIND
+# define MPOL_BIND 2
+#endif
+
+/*
+ * CPUs owned by running jobs are tracked host-wide by means of
+ * open file description locks on this file, one byte per CPU.
+ * The locks are held by the job runner, so they are released
+ * automatically when the runner terminates, however it happens.
+ */
+static const char cpu_lock_file[] = SOCKETDIR "/cpus";
+
+enum { MAX_NUMA_NODES = 1024 };
+
+/* How many times to retry when another job takes a chosen CPU first. */
+enum { ALLOC_ATTEMPTS = 8 };
+
+struct cpu_info {
+	unsigned int cpu;
+	int node;
+	int llc;
+	int core;
+};
+
+static int cpu_lock_fd = -1;
+static cpu_set_t allocated_cpus;
+static size_t allocated_count;
+static int allocated_node = -1;
+
+static int
+read_sysfs_int(const char *name)
+{
+	int val = -1;
+
+	FILE *fp = fopen(name, "r");
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%d", &val) != 1)
+		val = -1;
+	fclose(fp);
+	return val;
+}
+
+static int
+cpu_node(unsigned int cpu)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/sys/devices/system/cpu/cpu%u", cpu);
+
+	DIR *dir = opendir(name);
+	if (!dir)
+		return 0;
+
+	int node = 0;
+	struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		if (!strncmp(ent->d_name, "node", 4)) {
+			node = atoi(ent->d_name + 4);
+			break;
+		}
+	}
+
+	closedir(dir);
+	return node;
+}
+
+/*
+ * The last level cache domain of the CPU is identified by the first CPU
+ * in the shared_cpu_list of the highest level cache.
+ */
+static int
+cpu_llc(unsigned int cpu)
+{
+	static const char fmt[] =
+		"/sys/devices/system/cpu/cpu%u/cache/index%d/%s";
+	int llc = -1, level = 0;
+
+	for (int idx = 0; idx < 10; ++idx) {
+		char name[128];
+
+		snprintf(name, sizeof(name), fmt, cpu, idx, "level");
+		int lvl = read_sysfs_int(name);
+		if (lvl < 0)
+			break;
+		if (lvl < level)
+			continue;
+
+		snprintf(name, sizeof(name), fmt, cpu, idx, "shared_cpu_list");
+		int first = read_sysfs_int(name);
+		if (first >= 0) {
+			level = lvl;
+			llc = first;
+		}
+	}
+
+	return llc;
+}
+
+static void
+get_cpu_info(unsigned int cpu, struct cpu_info *info)
+{
+	static const char topology[] =
+		"/sys/devices/system/cpu/cpu%u/topology/%s";
+	char name[128];
+
+	info->cpu = cpu;
+	info->node = cpu_node(cpu);
+	info->llc = cpu_llc(cpu);
+
+	snprintf(name, sizeof(name), topology, cpu, "physical_package_id");
+	int package = read_sysfs_int(name);
+	snprintf(name, sizeof(name), topology, cpu, "core_id");
+	int core = read_sysfs_int(name);
+
+	/* Without topology information, every CPU is a core of its own. */
+	if (package < 0 || core < 0)
+		info->core = (int) cpu;
+	else
+		info->core = (package << 16) | (core & 0xffff);
+
+	if (info->llc < 0)
+		info->llc = package < 0 ? 0 : package;
+}
+
+/* Topologically close CPUs are adjacent in this order. */
+static int
+cpu_info_cmp(const void *a, const void *b)
+{
+	const struct cpu_info *x = a, *y = b;
+
+	if (x->node != y->node)
+		return x->node < y->node ? -1 : 1;
+	if (x->llc != y->llc)
+		return x->llc < y->llc ? -1 : 1;
+	if (x->core != y->core)
+		return x->core < y->core ? -1 : 1;
+	return x->cpu < y->cpu ? -1 : x->cpu > y->cpu;
+}
+
+static int
+cpu_lock(int cmd, short type, unsigned int cpu)
+{
+	struct flock fl = {
+		.l_type = type,
+		.l_whence = SEEK_SET,
+		.l_start = (off_t) cpu,
+		.l_len = 1,
+	};
+
+	if (fcntl(cpu_lock_fd, cmd, &fl) < 0)
+		return -1;
+
+	return cmd == F_OFD_GETLK ? fl.l_type == F_UNLCK : 1;
+}
+
+/*
+ * Choose nproc free CPUs among cpus[begin, end), taking whole free cores
+ * first, so that the job does not share cores with other jobs if possible.
+ */
+static size_t
+choose_cpus(const struct cpu_info *cpus, const char *free_cpus,
+	    size_t begin, size_t end, size_t nproc, cpu_set_t *set)
+{
+	size_t count = 0;
+
+	CPU_ZERO(set);
+	for (int pass = 0; pass < 2; ++pass) {
+		for (size_t i = begin; i < end && count < nproc; ) {
+			size_t j = i;
+			int whole = 1;
+
+			for (; j < end && cpus[j].core == cpus[i].core; ++j)
+				whole &= free_cpus[j];
+
+			if (pass || whole)
+				for (; i < j && count < nproc; ++i) {
+					if (!free_cpus[i] ||
+					    CPU_ISSET(cpus[i].cpu, set))
+						continue;
+					CPU_SET(cpus[i].cpu, set);
+					++count;
+				}
+			i = j;
+		}
+	}
+
+	return count;
+}
+
+/*
+ * Find the smallest domain, either a last level cache domain or,
+ * failing that, a NUMA node, that has nproc free CPUs, and choose
+ * CPUs in it.  If there is no such domain, choose CPUs in topology order.
+ */
+static int
+choose_compact_cpus(const struct cpu_info *cpus, const char *free_cpus,
+		    size_t n, size_t nproc, cpu_set_t *set)
+{
+	for (int by_node = 0; by_node < 2; ++by_node) {
+		size_t best_begin = 0, best_end = 0, best_free = 0;
+
+		for (size_t i = 0; i < n; ) {
+			size_t j = i, nfree = 0;
+
+			for (; j < n && cpus[j].node == cpus[i].node &&
+			       (by_node || cpus[j].llc == cpus[i].llc); ++j)
+				nfree += (size_t) free_cpus[j];
+
+			if (nfree >= nproc &&
+			    (!best_free || nfree < best_free)) {
+				best_begin = i;
+				best_end = j;
+				best_free = nfree;
+			}
+			i = j;
+		}
+
+		if (best_free) {
+			choose_cpus(cpus, free_cpus, best_begin, best_end,
+				    nproc, set);
+			return cpus[best_begin].node;
+		}
+	}
+
+	choose_cpus(cpus, free_cpus, 0, n, nproc, set);
+	return -1;
+}
+
+static int
+open_cpu_lock_file(void)
+{
+	if (cpu_lock_fd >= 0)
+		return 0;
+
+	cpu_lock_fd = open(cpu_lock_file,
+			   O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+	if (cpu_lock_fd < 0) {
+		perror_msg("open: %s", cpu_lock_file);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Allocate nproc CPUs for a job out of the CPUs allowed for the calling
+ * process and not owned by other jobs.  The allocation is kept until
+ * the calling process terminates.  Returns -1 if there are not enough
+ * free CPUs, so that the caller falls back to an unaccounted choice.
+ */
+int
+allocate_job_cpus(size_t nproc)
+{
+	cpu_set_t allowed;
+
+	if (!nproc)
+		return 0;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+		perror_msg("sched_getaffinity");
+		return -1;
+	}
+
+	size_t n = (size_t) CPU_COUNT(&allowed);
+	if (n <= nproc)
+		return 0;
+
+	if (open_cpu_lock_file() < 0)
+		return -1;
+
+	struct cpu_info *cpus = xcalloc(n, sizeof(*cpus));
+	char *free_cpus = xcalloc(n, 1);
+	size_t k = 0;
+
+	for (unsigned int cpu = 0; cpu < CPU_SETSIZE && k < n; ++cpu)
+		if (CPU_ISSET(cpu, &allowed))
+			get_cpu_info(cpu, &cpus[k++]);
+	qsort(cpus, n, sizeof(*cpus), cpu_info_cmp);
+
+	int rc = -1;
+	for (int attempt = 0; attempt < ALLOC_ATTEMPTS && rc < 0; ++attempt) {
+		size_t nfree = 0;
+
+		for (size_t i = 0; i < n; ++i) {
+			int is_free = cpu_lock(F_OFD_GETLK, F_WRLCK,
+					       cpus[i].cpu);
+			free_cpus[i] = (char) (is_free > 0);
+			nfree += (size_t) free_cpus[i];
+		}
+		if (nfree < nproc) {
+			debug_msg("only %zu out of %zu CPUs are free",
+				  nfree, n);
+			break;
+		}
+
+		cpu_set_t set;
+		int node = choose_compact_cpus(cpus, free_cpus, n, nproc, &set);
+
+		/* Lock the chosen CPUs, unless another job was faster. */
+		unsigned int cpu;
+		for (cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			if (CPU_ISSET(cpu, &set) &&
+			    cpu_lock(F_OFD_SETLK, F_WRLCK, cpu) < 0)
+				break;
+
+		if (cpu == CPU_SETSIZE) {
+			allocated_cpus = set;
+			allocated_count = nproc;
+			allocated_node = node;
+			rc = 0;
+		} else {
+			while (cpu-- > 0)
+				if (CPU_ISSET(cpu, &set))
+					(void) cpu_lock(F_OFD_SETLK, F_UNLCK,
+							cpu);
+		}
+	}
+
+	free(free_cpus);
+	free(cpus);
+	return rc;
+}
+
+/*
+ * Apply the CPUs allocated for the job to the calling process,
+ * and if requested, bind its memory policy to the NUMA node of these CPUs.
+ * Returns 1 if CPUs were allocated, 0 if they were not, or -1 on error.
+ */
+int
+setup_job_cpus(int bind_node)
+{
+	if (!allocated_count)
+		return 0;
+
+	if (sched_setaffinity(0, sizeof(allocated_cpus), &allocated_cpus) < 0)
+		return -1;
+
+	if (bind_node && allocated_node >= 0 &&
+	    allocated_node < MAX_NUMA_NODES) {
+		unsigned long mask[MAX_NUMA_NODES / (8 * sizeof(long))];
+		size_t node = (size_t) allocated_node;
+
+		memset(mask, 0, sizeof(mask));
+		mask[node / (8 * sizeof(long))] |=
+			1UL << (node % (8 * sizeof(long)));
+
+		if (syscall(__NR_set_mempolicy, MPOL_BIND, mask,
+			    sizeof(mask) * 8 + 1) < 0)
+			perror_msg("set_mempolicy: node %d", allocated_node);
+	}
+
+	return 1;
+}
@@ -0,0 +1,18 @@
+/*
+ * The CPU allocator interface for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_CPU_ALLOC_H
+# define HASHER_CPU_ALLOC_H
+
+# include <stddef.h>
+
+int allocate_job_cpus(size_t nproc);
+int setup_job_cpus(int bind_node);
+
+#endif /* !HASHER_CPU_ALLOC_H */
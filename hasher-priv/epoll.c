@@ -48,3 +48,14 @@ epoll_add_hup(int fd_ep, int fd)
 
 	return 0;
 }
+
+int
+epoll_del(int fd_ep, int fd)
+{
+	if (epoll_ctl(fd_ep, EPOLL_CTL_DEL, fd, NULL) < 0) {
+		perror_msg("epoll_ctl");
+		return -1;
+	}
+
+	return 0;
+}
@@ -14,5 +14,6 @@
 
 int epoll_add_in(int fd_ep, int fd);
 int epoll_add_hup(int fd_ep, int fd);
+int epoll_del(int fd_ep, int fd);
 
 #endif /* HASHER_EPOLL_H_ */
@@ -17,4 +17,9 @@ int     do_getugid2(void);
 int     do_chrootuid1(const char *const *argv, unsigned int persona);
 int     do_chrootuid2(const char *const *argv, unsigned int persona);
 
+/* Answers to read-only queries, also used by the session server. */
+char   *format_getconf(void);
+char   *format_getugid1(void);
+char   *format_getugid2(void);
+
 #endif /* !HASHER_EXECUTORS_H */
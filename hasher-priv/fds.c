@@ -11,6 +11,7 @@
 
 #include "error_prints.h"
 #include "fds.h"
+#include "macros.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -24,7 +25,14 @@
 #endif
 
 int chroot_fd = -1;
+int image_fd = -1;
 int log_fd = -1;
+int netns_fd = -1;
+int mount_tmpl_fd = -1;
+int mntns_fd = -1;
+int jobserver_rfd = -1;
+int jobserver_wfd = -1;
+int status_fd = -1;
 
 static int
 get_open_max(void)
@@ -109,14 +117,27 @@ reorder_fd(int start_fd, int *target_fdp)
 static int
 reorder_fds(int start_fd)
 {
-	/* Reorder log_fd, and chroot_fd. */
-	if (log_fd < chroot_fd) {
-		start_fd = reorder_fd(start_fd, &log_fd);
-		start_fd = reorder_fd(start_fd, &chroot_fd);
-	} else {
-		start_fd = reorder_fd(start_fd, &chroot_fd);
-		start_fd = reorder_fd(start_fd, &log_fd);
+	/*
+	 * Reorder log_fd, chroot_fd, image_fd, netns_fd, mount_tmpl_fd,
+	 * mntns_fd, jobserver_rfd, jobserver_wfd, and status_fd
+	 * in ascending order.
+	 */
+	int *fdps[] = {
+		&log_fd, &chroot_fd, &image_fd, &netns_fd, &mount_tmpl_fd,
+		&mntns_fd, &jobserver_rfd, &jobserver_wfd, &status_fd
+	};
+
+	for (unsigned int i = 1; i < ARRAY_SIZE(fdps); ++i) {
+		for (unsigned int j = i; j > 0 && *fdps[j - 1] > *fdps[j]; --j) {
+			int *tmp = fdps[j - 1];
+			fdps[j - 1] = fdps[j];
+			fdps[j] = tmp;
+		}
 	}
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(fdps); ++i)
+		start_fd = reorder_fd(start_fd, fdps[i]);
+
 	return start_fd;
 }
 
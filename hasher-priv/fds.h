@@ -16,6 +16,13 @@ void cloexec_fds(void);
 int xclose(int *fd);
 
 extern int chroot_fd;
+extern int image_fd;
 extern int log_fd;
+extern int netns_fd;
+extern int mount_tmpl_fd;
+extern int mntns_fd;
+extern int jobserver_rfd;
+extern int jobserver_wfd;
+extern int status_fd;
 
 #endif /* !HASHER_FDS_H */
@@ -12,9 +12,12 @@
 #include "chdir.h"
 #include "error_prints.h"
 #include "file_config.h"
+#include "io_loop.h"
+#include "xmalloc.h"
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -23,6 +26,190 @@
 
 #define MAX_CONFIG_SIZE 16384
 
+/*
+ * A snapshot of configuration files, see config_snapshot_record().
+ * Files are identified by their paths, which are made absolute using
+ * the working directory at the time of loading.
+ */
+struct config_file {
+	char *path;
+	char *data;
+	size_t len;
+};
+
+static enum {
+	SNAPSHOT_NONE,
+	SNAPSHOT_RECORD,
+	SNAPSHOT_REPLAY
+} snapshot_mode;
+static struct config_file *snapshot;
+static size_t snapshot_size;
+
+static char *
+config_path(const char *fname)
+{
+	char *cwd = getcwd(NULL, 0);
+	if (!cwd)
+		perror_msg_and_die("getcwd");
+
+	char *path = xasprintf("%s/%s", cwd, fname);
+	free(cwd);
+	return path;
+}
+
+static struct config_file *
+lookup_snapshot(const char *fname)
+{
+	char *path = config_path(fname);
+	struct config_file *f = NULL;
+
+	for (size_t i = 0; !f && i < snapshot_size; ++i)
+		if (!strcmp(snapshot[i].path, path))
+			f = &snapshot[i];
+
+	free(path);
+	return f;
+}
+
+static void
+add_snapshot(char *path, char *data, size_t len)
+{
+	snapshot = xreallocarray(snapshot, snapshot_size + 1,
+				 sizeof(*snapshot));
+	snapshot[snapshot_size++] = (struct config_file) {
+		.path = path, .data = data, .len = len
+	};
+}
+
+static FILE *
+open_snapshot_file(const struct config_file *f, const char *fname)
+{
+	/* An empty buffer is not accepted by fmemopen. */
+	FILE *fp = f->len ? fmemopen(f->data, f->len, "r")
+			  : fopen("/dev/null", "r");
+	if (!fp)
+		perror_msg_and_die("fmemopen: %s", fname);
+	return fp;
+}
+
+/*
+ * Start recording the contents of all configuration files loaded
+ * by this process, so that they can be passed to another process
+ * by config_snapshot_send().
+ */
+void
+config_snapshot_record(void)
+{
+	config_snapshot_release();
+	snapshot_mode = SNAPSHOT_RECORD;
+}
+
+/* Write the recorded configuration files to the descriptor. */
+int
+config_snapshot_send(int fd)
+{
+	for (size_t i = 0; i < snapshot_size; ++i) {
+		const struct config_file *f = &snapshot[i];
+		size_t path_len = strlen(f->path) + 1;
+
+		if (write_loop(fd, (const char *) &path_len,
+			       sizeof(path_len)) != sizeof(path_len) ||
+		    write_loop(fd, f->path, path_len) != (ssize_t) path_len ||
+		    write_loop(fd, (const char *) &f->len,
+			       sizeof(f->len)) != sizeof(f->len) ||
+		    write_loop(fd, f->data, f->len) != (ssize_t) f->len)
+			return -1;
+	}
+
+	return 0;
+}
+
+static char *
+read_snapshot_item(int fd, size_t *len, size_t max_len)
+{
+	ssize_t n = read_loop(fd, (char *) len, sizeof(*len));
+	if (n != (ssize_t) sizeof(*len) || *len > max_len)
+		return NULL;
+
+	char *buf = xmalloc(*len + 1);
+	if (read_loop(fd, buf, *len) != (ssize_t) *len) {
+		free(buf);
+		return NULL;
+	}
+	buf[*len] = '\0';
+	return buf;
+}
+
+/*
+ * Read configuration files written by config_snapshot_send() until EOF,
+ * and load them instead of the files on disk from now on,
+ * until config_snapshot_release().
+ */
+int
+config_snapshot_receive(int fd)
+{
+	config_snapshot_release();
+
+	for (;;) {
+		size_t path_len, len;
+		ssize_t n = read_loop(fd, (char *) &path_len,
+				      sizeof(path_len));
+		if (!n)
+			break;
+		if (n != (ssize_t) sizeof(path_len) || !path_len ||
+		    path_len > PATH_MAX)
+			goto fail;
+
+		char *path = xmalloc(path_len);
+		if (read_loop(fd, path, path_len) != (ssize_t) path_len ||
+		    path[path_len - 1]) {
+			free(path);
+			goto fail;
+		}
+
+		char *data = read_snapshot_item(fd, &len, MAX_CONFIG_SIZE);
+		if (!data) {
+			free(path);
+			goto fail;
+		}
+
+		add_snapshot(path, data, len);
+	}
+
+	snapshot_mode = SNAPSHOT_REPLAY;
+	return 0;
+
+fail:
+	config_snapshot_release();
+	return -1;
+}
+
+/* Forget the snapshot and load configuration files from disk again. */
+void
+config_snapshot_release(void)
+{
+	for (size_t i = 0; i < snapshot_size; ++i) {
+		free(snapshot[i].path);
+		free(snapshot[i].data);
+	}
+	free(snapshot);
+	snapshot = NULL;
+	snapshot_size = 0;
+	snapshot_mode = SNAPSHOT_NONE;
+}
+
+/*
+ * Check whether the configuration file exists, in the snapshot
+ * if configuration files are loaded from it.
+ */
+int
+config_exists(const char *fname)
+{
+	if (snapshot_mode == SNAPSHOT_REPLAY)
+		return !!lookup_snapshot(fname);
+	return !access(fname, F_OK);
+}
+
 void
 fread_config_name_value(FILE *fp, const char *fname, name_value_fn_t func)
 {
@@ -72,8 +259,12 @@ fread_config_name_value(FILE *fp, const char *fname, name_value_fn_t func)
 		perror_msg_and_die("fgets: %s", fname);
 }
 
-void
-load_config(const char *fname, fread_config_fn_t fread_config_func)
+/*
+ * Open the configuration file after validation,
+ * recording its contents if requested.
+ */
+static FILE *
+open_config_file(const char *fname)
 {
 	int fd = open(fname, O_RDONLY | O_NOFOLLOW | O_NOCTTY);
 	if (fd < 0)
@@ -92,9 +283,40 @@ load_config(const char *fname, fread_config_fn_t fread_config_func)
 		error_msg_and_die("%s: file too large: %lu",
 				  fname, (unsigned long) st.st_size);
 
+	if (snapshot_mode == SNAPSHOT_RECORD) {
+		/* Parse exactly what is recorded. */
+		char *data = xmalloc((size_t) st.st_size + 1);
+		ssize_t len = read_loop(fd, data, (size_t) st.st_size + 1);
+		if (len < 0)
+			perror_msg_and_die("read: %s", fname);
+		if (len > (ssize_t) st.st_size)
+			error_msg_and_die("%s: file changed while reading",
+					  fname);
+		if (close(fd))
+			perror_msg_and_die("close: %s", fname);
+		add_snapshot(config_path(fname), data, (size_t) len);
+		return open_snapshot_file(&snapshot[snapshot_size - 1], fname);
+	}
+
 	FILE *fp = fdopen(fd, "r");
 	if (!fp)
 		perror_msg_and_die("fdopen: %s", fname);
+	return fp;
+}
+
+void
+load_config(const char *fname, fread_config_fn_t fread_config_func)
+{
+	FILE *fp;
+
+	if (snapshot_mode == SNAPSHOT_REPLAY) {
+		const struct config_file *f = lookup_snapshot(fname);
+		if (!f)
+			error_msg_and_die("%s: not in the snapshot", fname);
+		fp = open_snapshot_file(f, fname);
+	} else {
+		fp = open_config_file(fname);
+	}
 
 	fread_config_func(fp, fname);
 
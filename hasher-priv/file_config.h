@@ -25,4 +25,11 @@ void fread_config_name_value(FILE *fp, const char *fname, name_value_fn_t)
 void load_config(const char *fname, fread_config_fn_t)
 	ATTRIBUTE_NONNULL((1, 2));
 
+int config_exists(const char *fname);
+
+void config_snapshot_record(void);
+int config_snapshot_send(int fd);
+int config_snapshot_receive(int fd);
+void config_snapshot_release(void);
+
 #endif /* !HASHER_FILE_CONFIG_H */
@@ -11,11 +11,23 @@
 
 #include "caller_config.h"
 #include "executors.h"
+#include "xmalloc.h"
 #include <stdio.h>
+#include <stdlib.h>
+
+char *
+format_getconf(void)
+{
+	return xasprintf("%s/%s\n", "/etc/hasher-priv/user.d",
+			 caller_config_file_name);
+}
 
 int
 do_getconf(void)
 {
-	printf("%s/%s\n", "/etc/hasher-priv/user.d", caller_config_file_name);
+	char *str = format_getconf();
+
+	fputs(str, stdout);
+	free(str);
 	return 0;
 }
@@ -11,18 +11,38 @@
 
 #include "caller_config.h"
 #include "executors.h"
+#include "xmalloc.h"
 #include <stdio.h>
+#include <stdlib.h>
+
+char *
+format_getugid1(void)
+{
+	return xasprintf("%u:%u\n", change_uid1, change_gid1);
+}
+
+char *
+format_getugid2(void)
+{
+	return xasprintf("%u:%u\n", change_uid2, change_gid2);
+}
 
 int
 do_getugid1(void)
 {
-	printf("%u:%u\n", change_uid1, change_gid1);
+	char *str = format_getugid1();
+
+	fputs(str, stdout);
+	free(str);
 	return 0;
 }
 
 int
 do_getugid2(void)
 {
-	printf("%u:%u\n", change_uid2, change_gid2);
+	char *str = format_getugid2();
+
+	fputs(str, stdout);
+	free(str);
 	return 0;
 }
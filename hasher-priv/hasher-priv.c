@@ -16,11 +16,15 @@
 #include "error_prints.h"
 #include "executors.h"
 #include "fds.h"
+#include "io_loop.h"
+#include "opt_parse.h"
 #include "pass.h"
 #include "sockets.h"
 #include "xmalloc.h"
 #include "xstring.h"
 
+#include <fcntl.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -46,8 +50,14 @@ recv_response(int conn, const char *name)
 					  " to %s", name);
 		}
 
-		if (*data)
+		if (rs.rc == CMD_STATUS_ANSWER) {
+			size_t len = strnlen(data, rs.len);
+
+			if (write_loop(STDOUT_FILENO, data, len) != (ssize_t) len)
+				perror_msg_and_die("write");
+		} else if (*data) {
 			error_msg("%s: %s", name, data);
+		}
 
 		free(data);
 	}
@@ -55,6 +65,10 @@ recv_response(int conn, const char *name)
 	if (rs.rc == CMD_STATUS_FAILED)
 		error_msg_and_die("failed");
 
+	/* The query has been answered by the session server. */
+	if (rs.rc == CMD_STATUS_ANSWER)
+		return CMD_STATUS_DONE;
+
 	return rs.rc;
 }
 
@@ -97,92 +111,174 @@ connect_to_session(void)
 	return srv_connect(SOCKETDIR, socketname);
 }
 
-static void
-send_type(int conn, job_enum_t type)
+static size_t
+strings_size(const char **argv, const char *name)
 {
-	cmd_header_t hdr = {
-		.type = CMD_JOB_TYPE,
-		.len = type,
-	};
+	size_t size = 0;
+	for (const char **args = argv; args && *args; ++args)
+		size += strlen(*args) + 1;
 
-	if (xsendmsg(conn, &hdr, sizeof(hdr)) < 0)
-		error_msg_and_die("failed to send header");
+	if (size != (unsigned int) size)
+		error_msg_and_die("%s: too big to send", name);
 
-	(void) recv_response(conn, "job type");
+	return size;
 }
 
-static void
-send_personality(int conn)
+static char *
+copy_strings(char *p, const char **argv)
 {
-	const int pers = personality(0xffffffff);
-	if (pers < 0) {
-		perror_msg("personality");
-		return;
-	}
-
-	cmd_header_t hdr = {
-		.type = CMD_JOB_PERSONALITY,
-		.len = (unsigned int) pers
-	};
-
-	if (xsendmsg(conn, &hdr, sizeof(hdr)) < 0)
-		error_msg_and_die("failed to send header");
+	for (const char **args = argv; args && *args; ++args)
+		p = stpcpy(p, *args) + 1;
 
-	(void) recv_response(conn, "personality");
+	return p;
 }
 
+/* Save the resources consumed by the job in a form suitable for scripts. */
 static void
-send_fds(int conn, cmd_enum_t cmd, const char *name,
-	 int *fds, unsigned int n_fds)
+write_job_usage(const char *fname, const job_usage_t *u, unsigned int flags)
 {
-	cmd_header_t hdr = {
-		.type = cmd,
-		.len = sizeof(fds[0]) * n_fds,
-	};
-
-	if (xsendmsg(conn, &hdr, sizeof(hdr)) < 0)
-		error_msg_and_die("%s: failed to send header", name);
-
-	fd_send(conn, fds, n_fds, 0, 0);
+	FILE *fp = fopen(fname, "w");
+	if (!fp) {
+		perror_msg("fopen: %s", fname);
+		return;
+	}
 
-	(void) recv_response(conn, name);
+	fprintf(fp,
+		"wall_usec=%llu\n"
+		"user_usec=%llu\n"
+		"system_usec=%llu\n"
+		"max_rss=%llu\n"
+		"memory_peak=%llu\n"
+		"minor_faults=%llu\n"
+		"major_faults=%llu\n"
+		"voluntary_switches=%llu\n"
+		"involuntary_switches=%llu\n"
+		"blocks_read=%llu\n"
+		"blocks_written=%llu\n"
+		"bytes_read=%llu\n"
+		"bytes_written=%llu\n",
+		u->wall_usec, u->user_usec, u->system_usec,
+		u->max_rss, u->memory_peak,
+		u->minor_faults, u->major_faults,
+		u->voluntary_switches, u->involuntary_switches,
+		u->blocks_read, u->blocks_written,
+		u->bytes_read, u->bytes_written);
+
+	if (flags & JOB_SUBMIT_PERF)
+		fprintf(fp,
+			"instructions=%llu\n"
+			"cycles=%llu\n"
+			"cache_misses=%llu\n"
+			"branch_misses=%llu\n"
+			"task_clock_nsec=%llu\n",
+			u->instructions, u->cycles,
+			u->cache_misses, u->branch_misses,
+			u->task_clock_nsec);
+
+	if (fclose(fp))
+		perror_msg("fclose: %s", fname);
 }
 
-static void
-send_strings(int conn, cmd_enum_t cmd, const char *name, const char **argv)
+/* Send the whole job description in a single message. */
+static int
+submit_job(int conn, job_enum_t type, const char **argv, const char **envp)
 {
-	size_t size = 0;
-	for (const char **args = argv; args && *args; ++args)
-		size += strlen(*args) + 1;
-
-	cmd_header_t hdr = {
-		.type = cmd,
-		.len = (unsigned int) size
+	int fds[JOB_SUBMIT_MAX_FDS] = {
+		STDIN_FILENO,
+		STDOUT_FILENO,
+		STDERR_FILENO,
 	};
-	if (hdr.len != size)
-		error_msg_and_die("%s: too big to send", name);
+	unsigned int n_fds = 3;
+	unsigned int flags = 0;
+	int pers = -1;
+	const char *usage_file = NULL;
+
+	if (type == JOB_CHROOTUID1 || type == JOB_CHROOTUID2) {
+		fds[n_fds++] = chroot_fd;
+		flags |= JOB_SUBMIT_QUEUE;
+		pers = personality(0xffffffff);
+		if (pers < 0)
+			perror_msg("personality");
+
+		/* The image to be mounted on top of the chroot directory. */
+		const char *image = getenv("chroot_image");
+		if (image && *image) {
+			int fd = open(image, O_RDONLY | O_CLOEXEC);
+			if (fd < 0)
+				perror_msg_and_die("%s", image);
+			fds[n_fds++] = fd;
+			flags |= JOB_SUBMIT_IMAGE;
+		}
 
-	if (xsendmsg(conn, &hdr, sizeof(hdr)) < 0)
-		error_msg_and_die("%s: error sending header", name);
+		/* The file to save the resources consumed by the job to. */
+		usage_file = getenv("job_usage_file");
+		if (usage_file && *usage_file) {
+			flags |= JOB_SUBMIT_USAGE;
 
-	for (const char **args = argv; args && *args; ++args)
-		if (xsendmsg(conn, (char *) *args, strlen(*args) + 1) < 0)
-			error_msg_and_die("%s: error sending data", name);
+			const char *perf = getenv("job_perf_counters");
+			if (perf && opt_str2bool("job_perf_counters", perf,
+						 "environment"))
+				flags |= JOB_SUBMIT_PERF;
+		}
+	} else {
+		envp = NULL;
 
-	(void) recv_response(conn, name);
-}
+		/* Let the session server send the answer to a query. */
+		if (type == JOB_GETCONF ||
+		    type == JOB_GETUGID1 || type == JOB_GETUGID2)
+			flags |= JOB_SUBMIT_ANSWER;
+	}
 
-static int
-send_run(int conn)
-{
-	cmd_header_t hdr = {
-		.type = CMD_JOB_RUN,
+	job_submit_t js = {
+		.version = JOB_PROTO_VERSION,
+		.type = type,
+		.persona = (unsigned int) pers,
+		.n_fds = n_fds,
+		.args_len = (unsigned int) strings_size(argv, "arguments"),
+		.env_len = (unsigned int) strings_size(envp, "environment"),
+		.flags = flags,
 	};
 
-	if (xsendmsg(conn, &hdr, sizeof(hdr)) < 0)
-		error_msg_and_die("failed to send header");
+	size_t len = sizeof(js) + (size_t) js.args_len + js.env_len;
+	cmd_header_t hdr = {
+		.type = CMD_JOB_SUBMIT,
+		.len = (unsigned int) len,
+	};
+	if (hdr.len != len)
+		error_msg_and_die("job description is too big to send");
+
+	char *buf = xmalloc(sizeof(hdr) + len);
+	char *p = buf;
+
+	memcpy(p, &hdr, sizeof(hdr));
+	p += sizeof(hdr);
+	memcpy(p, &js, sizeof(js));
+	p += sizeof(js);
+	p = copy_strings(p, argv);
+	(void) copy_strings(p, envp);
+
+	fd_send(conn, fds, n_fds, buf, sizeof(hdr) + len);
+	free(buf);
+
+	/* The job may have to wait for a free slot before it starts. */
+	int rc;
+	while ((rc = recv_response(conn, "job")) == CMD_STATUS_QUEUED)
+		;
+
+	/*
+	 * The resource usage follows only the exit status of a job
+	 * that has completed, not a failure to run it.
+	 */
+	if ((flags & JOB_SUBMIT_USAGE) && rc != CMD_STATUS_FAILED) {
+		job_usage_t usage;
+
+		if (xrecvmsg(conn, &usage, sizeof(usage)) < 0)
+			error_msg("failed to receive job resource usage");
+		else
+			write_job_usage(usage_file, &usage, flags);
+	}
 
-	return recv_response(conn, "run");
+	return rc;
 }
 
 int
@@ -198,21 +294,5 @@ main(int ac, const char *av[], const char *ev[])
 	/* Open a user session */
 	int conn = connect_to_session();
 
-	int fds[] = {
-		STDIN_FILENO,
-		STDOUT_FILENO,
-		STDERR_FILENO,
-	};
-	send_type(conn, job);
-	send_fds(conn, CMD_JOB_FDS, "stdio", fds, ARRAY_SIZE(fds));
-	if (args)
-		send_strings(conn, CMD_JOB_ARGUMENTS, "arguments", args);
-	if (job == JOB_CHROOTUID1 || job == JOB_CHROOTUID2) {
-		send_strings(conn, CMD_JOB_ENVIRON, "environment", ev);
-		send_fds(conn, CMD_JOB_CHROOT_FD, "chroot descriptor",
-			 &chroot_fd, 1);
-		send_personality(conn);
-	}
-
-	return send_run(conn);
+	return submit_job(conn, job, args, ev);
 }
@@ -12,6 +12,7 @@
 
 /* Code in this file may be executed with root privileges. */
 
+#include "admission.h"
 #include "caller_config.h"
 #include "caller_data.h"
 #include "caller_server.h"
@@ -20,6 +21,7 @@
 #include "error_prints.h"
 #include "fds.h"
 #include "io_loop.h"
+#include "jobserver.h"
 #include "logging.h"
 #include "macros.h"
 #include "pidfile.h"
@@ -31,6 +33,7 @@
 #include "xmalloc.h"
 #include "xstring.h"
 #include "title.h"
+#include "unblock_fd.h"
 
 #include <sys/epoll.h>
 #include <sys/prctl.h>
@@ -42,11 +45,13 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 struct session {
@@ -60,8 +65,30 @@ struct session {
 	pid_t server_pid;
 };
 
+/* A connection to the main socket that has not sent its request yet. */
+struct request {
+	struct request *next;
+
+	int conn;
+
+	/* The number of bytes of the header received so far. */
+	size_t received;
+	cmd_header_t hdr;
+
+	/* CLOCK_MONOTONIC time in milliseconds when the request expires. */
+	long long deadline;
+};
+
+enum {
+	/* The maximum number of connections accepted in a row. */
+	ACCEPT_BATCH_SIZE = 64
+};
+
 static struct hadaemon dn = { {-1, -1}, -1, -1, -1, };
 static struct session *pool;
+static struct request *requests;
+static unsigned int n_requests;
+static int accepting;
 
 static void
 create_socket_node(struct hadaemon* d)
@@ -71,9 +98,11 @@ create_socket_node(struct hadaemon* d)
 	char socketpath[UNIX_PATH_MAX];
 	xsprintf(socketpath, "%s/%s", SOCKETDIR, MAIN_SOCKET_BASE_NAME);
 
-	if ((d->fd_conn = srv_listen(socketpath)) < 0)
+	if ((d->fd_conn = srv_listen(socketpath, server_listen_backlog)) < 0)
 		perror_msg_and_die("srv_listen");
 
+	unblock_fd(d->fd_conn);
+
 	umask(m);
 
 	if (chown(socketpath, 0, server_gid))
@@ -90,6 +119,13 @@ run_caller_server(struct hadaemon *d, int cl_conn, const struct session *a)
 	xclose(&d->fd_ep);
 	xclose(&d->fd_signal);
 	xclose(&d->fd_conn);
+	admission_close();
+
+	/* Pending requests are handled by the main server. */
+	for (struct request *r = requests; r; r = r->next) {
+		if (r->conn != cl_conn)
+			xclose(&r->conn);
+	}
 
 	caller_num = a->caller_num;
 	init_caller_data(a->caller_uid, a->caller_gid);
@@ -178,29 +214,168 @@ start_session(struct hadaemon *d, int conn, unsigned num)
 }
 
 static void
-process_request(struct hadaemon *d, int conn)
+process_request(struct hadaemon *d, int conn, const cmd_header_t *hdr)
 {
-	if (set_recv_timeout(conn, 3) < 0)
-		return;
-
-	cmd_header_t hdr = { 0 };
-	if (xrecvmsg(conn, &hdr, sizeof(hdr)) < 0)
-		return;
-
-	switch (hdr.type) {
+	switch (hdr->type) {
 		case CMD_OPEN_SESSION:
-			if (start_session(d, conn, hdr.len) < 0) {
+			if (start_session(d, conn, hdr->len) < 0) {
 				send_response_to_client(conn, CMD_STATUS_FAILED,
 							"command failed");
 			}
 			break;
 		default:
-			error_msg("unknown command: %d", hdr.type);
+			error_msg("unknown command: %d", hdr->type);
 			send_response_to_client(conn, CMD_STATUS_FAILED,
 						"unknown command");
 	}
 }
 
+static long long
+monotonic_msec(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		perror_msg_and_die("clock_gettime");
+
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+set_accepting(struct hadaemon *d, int enable)
+{
+	if (accepting == enable)
+		return;
+
+	if (enable ? epoll_add_in(d->fd_ep, d->fd_conn)
+		   : epoll_del(d->fd_ep, d->fd_conn))
+		perror_msg_and_die("epoll_ctl");
+
+	accepting = enable;
+}
+
+static void
+free_request(struct hadaemon *d, struct request **rp)
+{
+	struct request *r = *rp;
+
+	*rp = r->next;
+	(void) epoll_del(d->fd_ep, r->conn);
+	xclose(&r->conn);
+	free(r);
+	--n_requests;
+
+	/* There is room for new connections again. */
+	set_accepting(d, 1);
+}
+
+static void
+accept_requests(struct hadaemon *d)
+{
+	struct request **tail = &requests;
+	while (*tail)
+		tail = &(*tail)->next;
+
+	for (unsigned int i = 0; i < ACCEPT_BATCH_SIZE; ++i) {
+		if (n_requests >= (unsigned int) server_listen_backlog) {
+			/*
+			 * Leave the rest in the listen queue until
+			 * some of the pending requests are handled.
+			 */
+			set_accepting(d, 0);
+			return;
+		}
+
+		int conn = accept4(d->fd_conn, NULL, 0,
+				   SOCK_CLOEXEC | SOCK_NONBLOCK);
+		if (conn < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK &&
+			    errno != EINTR)
+				perror_msg("accept4");
+			return;
+		}
+
+		struct request *r = calloc(1, sizeof(*r));
+		if (!r) {
+			perror_msg("calloc");
+			xclose(&conn);
+			continue;
+		}
+
+		r->conn = conn;
+		r->deadline = monotonic_msec() +
+			      (long long) server_request_timeout * 1000;
+
+		if (epoll_add_in(d->fd_ep, conn) < 0) {
+			xclose(&r->conn);
+			free(r);
+			continue;
+		}
+
+		/* Requests are queued in the order of their deadlines. */
+		*tail = r;
+		tail = &r->next;
+		++n_requests;
+	}
+}
+
+/* Receive as much of the request header as available without blocking. */
+static void
+read_request(struct hadaemon *d, int conn)
+{
+	struct request **rp = &requests;
+	while (*rp && (*rp)->conn != conn)
+		rp = &(*rp)->next;
+
+	struct request *r = *rp;
+	if (!r)
+		return;
+
+	ssize_t n = recv(conn, (char *) &r->hdr + r->received,
+			 sizeof(r->hdr) - r->received, MSG_DONTWAIT);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+		perror_msg("recv");
+		free_request(d, rp);
+		return;
+	}
+
+	if (n == 0) {
+		error_msg("recv: unexpected EOF");
+		free_request(d, rp);
+		return;
+	}
+
+	r->received += (size_t) n;
+	if (r->received < sizeof(r->hdr))
+		return;
+
+	process_request(d, conn, &r->hdr);
+	free_request(d, rp);
+}
+
+/*
+ * Drop requests that have not been received in time
+ * and return the epoll timeout till the nearest deadline.
+ */
+static int
+expire_requests(struct hadaemon *d)
+{
+	long long now = monotonic_msec();
+
+	while (requests && requests->deadline <= now) {
+		error_msg("request timed out");
+		free_request(d, &requests);
+	}
+
+	if (!requests)
+		return -1;
+
+	long long timeout = requests->deadline - now;
+	return timeout > INT_MAX ? INT_MAX : (int) timeout;
+}
+
 static void
 free_session(const pid_t pid)
 {
@@ -354,16 +529,24 @@ main(int argc, char **argv)
 
 	create_socket_node(d);
 
+	if (server_jobserver_tokens &&
+	    jobserver_init(server_jobserver_tokens) < 0)
+		error_msg_and_die("failed to create the jobserver");
+
 	if ((d->fd_signal = daemon_create_signal_fd()) < 0)
 		perror_msg_and_die("signalfd");
 
 	if ((d->fd_ep = epoll_create1(EPOLL_CLOEXEC)) < 0)
 		perror_msg_and_die("epoll_create1");
 
-	if (epoll_add_in(d->fd_ep, d->fd_signal) < 0 ||
-	    epoll_add_in(d->fd_ep, d->fd_conn) < 0)
+	if (epoll_add_in(d->fd_ep, d->fd_signal) < 0)
 		perror_msg_and_die("epoll_add_in");
 
+	set_accepting(d, 1);
+
+	if (admission_init(d->fd_ep) < 0)
+		error_msg_and_die("failed to set up admission control");
+
 	/*
 	 * As we use waitpid, SIGCHLD should not be ignored.
 	 */
@@ -383,6 +566,13 @@ main(int argc, char **argv)
 	int finish_server = 0;
 
 	while (!finish_server) {
+		ep_timeout = expire_requests(d);
+
+		int adm_timeout = admission_timeout(monotonic_msec());
+		if (adm_timeout >= 0 &&
+		    (ep_timeout < 0 || adm_timeout < ep_timeout))
+			ep_timeout = adm_timeout;
+
 		errno = 0;
 		struct epoll_event ev[16];
 		int fdcount = epoll_wait(d->fd_ep, ev, ARRAY_SIZE(ev), ep_timeout);
@@ -427,20 +617,24 @@ main(int argc, char **argv)
 			}
 		}
 		for (i = 0; !finish_server && i < fdcount; i++) {
-			if (!(ev[i].events & EPOLLIN))
+			if (ev[i].data.fd == d->fd_signal)
 				continue;
 
 			if (ev[i].data.fd == d->fd_conn) {
-				int conn = accept4(d->fd_conn, NULL, 0, SOCK_CLOEXEC);
-				if (conn < 0) {
-					perror_msg("accept4");
-					continue;
-				}
-
-				process_request(d, conn);
-				xclose(&conn);
+				if (ev[i].events & EPOLLIN)
+					accept_requests(d);
+				continue;
 			}
+
+			if (admission_handle_event(d->fd_ep, ev[i].data.fd))
+				continue;
+
+			if (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				read_request(d, ev[i].data.fd);
 		}
+
+		if (!finish_server)
+			admission_tick(d->fd_ep, monotonic_msec());
 	}
 
 	notice_msg("shutting down");
@@ -0,0 +1,253 @@
+/*
+ * The chroot image setup for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root privileges. */
+
+#include "caller_config.h"
+#include "chdir.h"
+#include "error_prints.h"
+#include "fds.h"
+#include "image.h"
+#include "mount_api.h"
+#include "overlay.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/loop.h>
+
+#ifndef LOOP_CONFIGURE
+# define LOOP_CONFIGURE		0x4C0A
+#endif
+
+/* The first version of struct loop_config, as of Linux v5.8. */
+struct loop_config_v0 {
+	__u32 fd;
+	__u32 block_size;
+	struct loop_info64 info;
+	__u64 reserved[8];
+};
+
+/* The number of attempts to grab a free loop device. */
+#define LOOP_ATTEMPTS	16
+
+/* The name of the backing file of the loop devices set up for images. */
+#define LOOP_FILE_NAME	"hasher-priv"
+
+static void
+check_mount_api(int rc, const char *what)
+{
+	if (rc >= 0)
+		return;
+	if (errno == ENOSYS)
+		perror_msg_and_die("image: the new mount API"
+				   " is not supported by the kernel");
+	perror_msg_and_die("image: %s", what);
+}
+
+static int
+has_magic(const void *magic, size_t size, off_t offset)
+{
+	char buf[8];
+
+	if (size > sizeof(buf))
+		return 0;
+	if (pread(image_fd, buf, size, offset) != (ssize_t) size)
+		return 0;
+	return !memcmp(buf, magic, size);
+}
+
+static const char *
+detect_fstype(void)
+{
+	/* EROFS_SUPER_MAGIC_V1, little-endian, at EROFS_SUPER_OFFSET. */
+	static const unsigned char erofs_magic[] = { 0xe2, 0xe1, 0xf5, 0xe0 };
+	/* SQUASHFS_MAGIC, little-endian, at the start of the image. */
+	static const unsigned char squashfs_magic[] = { 'h', 's', 'q', 's' };
+
+	if (has_magic(erofs_magic, sizeof(erofs_magic), 1024))
+		return "erofs";
+	if (has_magic(squashfs_magic, sizeof(squashfs_magic), 0))
+		return "squashfs";
+
+	error_msg_and_die("image: unrecognized file system type");
+}
+
+/*
+ * Find a loop device that has been attached to the image described by st
+ * for another job and is still in use.  The kernel shares the superblock
+ * of a file system between all mounts of the same block device, so jobs
+ * using the same image share its page cache, including decompressed data,
+ * instead of keeping a copy each.
+ * Returns the descriptor of the loop device, its name is stored in name,
+ * or -1 if there is no such device.
+ */
+static int
+find_loop(const struct stat *st, char *name, size_t size)
+{
+	DIR *dir = opendir("/sys/block");
+	if (!dir)
+		return -1;
+
+	int fd = -1;
+	const struct dirent *ent;
+	while (fd < 0 && (ent = readdir(dir))) {
+		unsigned int nr;
+		char c;
+		if (sscanf(ent->d_name, "loop%u%c", &nr, &c) != 1)
+			continue;
+
+		snprintf(name, size, "/dev/loop%u", nr);
+		fd = open(name, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		/*
+		 * The device is checked after it has been opened:
+		 * an open device is not cleared automatically, so it cannot
+		 * be attached to another file after the check.
+		 */
+		struct loop_info64 info;
+		if (ioctl(fd, LOOP_GET_STATUS64, &info) < 0 ||
+		    info.lo_device != st->st_dev ||
+		    info.lo_inode != st->st_ino ||
+		    info.lo_offset || info.lo_sizelimit ||
+		    (info.lo_flags & (LO_FLAGS_READ_ONLY |
+				      LO_FLAGS_AUTOCLEAR)) !=
+		    (LO_FLAGS_READ_ONLY | LO_FLAGS_AUTOCLEAR) ||
+		    strncmp((const char *) info.lo_file_name, LOOP_FILE_NAME,
+			    sizeof(info.lo_file_name)))
+			xclose(&fd);
+	}
+
+	closedir(dir);
+	return fd;
+}
+
+/*
+ * Attach image_fd to a free read-only loop device which is detached
+ * automatically when the last reference to it is gone.
+ * Returns the descriptor of the loop device, its name is stored in name.
+ */
+static int
+attach_loop(char *name, size_t size)
+{
+	int ctl_fd = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+	if (ctl_fd < 0)
+		perror_msg_and_die("open: %s", "/dev/loop-control");
+
+	for (unsigned int i = 0; i < LOOP_ATTEMPTS; ++i) {
+		int nr = ioctl(ctl_fd, LOOP_CTL_GET_FREE);
+		if (nr < 0)
+			perror_msg_and_die("ioctl: %s", "LOOP_CTL_GET_FREE");
+
+		snprintf(name, size, "/dev/loop%d", nr);
+		int fd = open(name, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			perror_msg_and_die("open: %s", name);
+
+		struct loop_config_v0 config = {
+			.fd = (__u32) image_fd,
+			.info = {
+				.lo_flags = LO_FLAGS_READ_ONLY |
+					    LO_FLAGS_AUTOCLEAR,
+			},
+		};
+		strncpy((char *) config.info.lo_file_name, LOOP_FILE_NAME,
+			sizeof(config.info.lo_file_name) - 1);
+
+		int rc = ioctl(fd, LOOP_CONFIGURE, &config);
+		if (rc < 0 && (errno == EINVAL || errno == ENOTTY)) {
+			/*
+			 * LOOP_CONFIGURE is not supported by the kernel,
+			 * fall back to the racy LOOP_SET_FD + LOOP_SET_STATUS64.
+			 * The device is read-only because image_fd is.
+			 */
+			rc = ioctl(fd, LOOP_SET_FD, image_fd);
+			if (rc == 0 &&
+			    ioctl(fd, LOOP_SET_STATUS64, &config.info) < 0) {
+				int saved_errno = errno;
+				(void) ioctl(fd, LOOP_CLR_FD, 0);
+				errno = saved_errno;
+				perror_msg_and_die("ioctl: %s: %s",
+						   name, "LOOP_SET_STATUS64");
+			}
+		}
+
+		if (rc == 0) {
+			xclose(&ctl_fd);
+			return fd;
+		}
+
+		/* Somebody else has grabbed the device, try another one. */
+		if (errno != EBUSY)
+			perror_msg_and_die("ioctl: %s: %s", name, "LOOP_CONFIGURE");
+		xclose(&fd);
+	}
+
+	error_msg_and_die("image: failed to find a free loop device");
+}
+
+/*
+ * Mount the file system image passed as image_fd read-only,
+ * create a detached writable overlay on top of it for the current
+ * directory, which is the chroot directory, and return its descriptor.
+ */
+int
+create_image_overlay(void)
+{
+	if (!allow_chroot_image)
+		error_msg_and_die("image: chroot images are not allowed");
+
+	struct stat st;
+	if (fstat(image_fd, &st) < 0)
+		perror_msg_and_die("image: fstat");
+	if (!S_ISREG(st.st_mode))
+		error_msg_and_die("image: not a regular file");
+	stat_caller_ok_validator(&st, "image");
+
+	const char *fstype = detect_fstype();
+
+	char name[sizeof("/dev/loop") + sizeof(int) * 3];
+	int loop_fd = find_loop(&st, name, sizeof(name));
+	if (loop_fd < 0)
+		loop_fd = attach_loop(name, sizeof(name));
+
+	int fs_fd = sys_fsopen(fstype, FSOPEN_CLOEXEC);
+	check_mount_api(fs_fd, "fsopen");
+	check_mount_api(sys_fsconfig(fs_fd, FSCONFIG_SET_STRING,
+				     "source", name, 0), "fsconfig");
+	check_mount_api(sys_fsconfig(fs_fd, FSCONFIG_SET_FLAG,
+				     "ro", NULL, 0), "fsconfig");
+	check_mount_api(sys_fsconfig(fs_fd, FSCONFIG_CMD_CREATE,
+				     NULL, NULL, 0), "fsconfig");
+
+	/*
+	 * The image is provided by the caller, so neither set-user-ID
+	 * programs nor devices from it are to be trusted.
+	 */
+	const unsigned int attr_flags = MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV;
+	int mnt_fd = sys_fsmount(fs_fd, FSMOUNT_CLOEXEC,
+				 MOUNT_ATTR_RDONLY | attr_flags);
+	check_mount_api(mnt_fd, "fsmount");
+	xclose(&fs_fd);
+
+	/* The mount holds its own reference to the loop device. */
+	xclose(&loop_fd);
+	xclose(&image_fd);
+
+	int ovl_fd = create_overlay(mnt_fd, attr_flags);
+	xclose(&mnt_fd);
+
+	return ovl_fd;
+}
@@ -0,0 +1,15 @@
+/*
+ * The chroot image setup for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_IMAGE_H
+# define HASHER_IMAGE_H
+
+int create_image_overlay(void);
+
+#endif /* !HASHER_IMAGE_H */
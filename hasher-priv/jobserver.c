@@ -0,0 +1,269 @@
+/*
+ * The host-wide make jobserver for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root or caller privileges. */
+
+#include "error_prints.h"
+#include "fds.h"
+#include "jobserver.h"
+#include "xmalloc.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+/*
+ * The token pool shared by all jobs on the host is a pipe created by
+ * the daemon and inherited by session servers and job runners.
+ * Jobs never see it: every chrootuid job gets a pipe of its own which is
+ * passed to make by means of MAKEFLAGS, and the runner of the job moves
+ * tokens between the pool and the job pipe.  The runner remembers how many
+ * tokens the job has taken from the pool and returns exactly that many
+ * when the job ends, so tokens held by killed processes are not lost,
+ * and a job cannot add tokens to the pool.
+ */
+static int pool_fds[2] = { -1, -1 };
+
+/* The job pipe as seen by the runner, in non-blocking mode. */
+static int broker_fds[2] = { -1, -1 };
+
+static unsigned long tokens_taken;
+static unsigned long tokens_limit;
+static unsigned long last_batch;
+
+static const char token = '+';
+
+/*
+ * Create a pipe for the token pool that can hold all the tokens,
+ * raising its capacity if necessary.
+ */
+static int
+create_pool(int fds[2], unsigned long tokens)
+{
+	if (pipe2(fds, O_CLOEXEC | O_NONBLOCK)) {
+		perror_msg("pipe2");
+		return -1;
+	}
+
+	int size = fcntl(fds[1], F_GETPIPE_SZ);
+	if (size < 0) {
+		perror_msg("fcntl: %s", "F_GETPIPE_SZ");
+	} else if ((unsigned long) size < tokens) {
+		size = tokens <= INT_MAX
+		       ? fcntl(fds[1], F_SETPIPE_SZ, (int) tokens) : -1;
+		if (size < 0 && tokens <= INT_MAX)
+			perror_msg("fcntl: %s", "F_SETPIPE_SZ");
+	}
+
+	if (size < 0 || (unsigned long) size < tokens) {
+		error_msg("jobserver: a pipe cannot hold %lu tokens", tokens);
+		xclose(&fds[0]);
+		xclose(&fds[1]);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Returns 0 if the token pool can hold the given number of tokens,
+ * -1 otherwise.
+ */
+int
+jobserver_check_tokens(unsigned long tokens)
+{
+	int fds[2];
+
+	if (create_pool(fds, tokens) < 0)
+		return -1;
+
+	xclose(&fds[0]);
+	xclose(&fds[1]);
+	return 0;
+}
+
+int
+jobserver_init(unsigned long tokens)
+{
+	if (create_pool(pool_fds, tokens) < 0)
+		return -1;
+
+	for (unsigned long i = 0; i < tokens; ++i) {
+		if (write(pool_fds[1], &token, 1) != 1) {
+			perror_msg("jobserver: cannot add token %lu", i + 1);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+reopen_nonblock(int fd, int flags)
+{
+	char path[sizeof("/proc/self/fd/") + sizeof(int) * 3];
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	int rc = open(path, flags | O_NONBLOCK | O_CLOEXEC);
+	if (rc < 0)
+		perror_msg("open: %s", path);
+	return rc;
+}
+
+/*
+ * Create the job pipe for a chrootuid job, the job gets up to nproc - 1
+ * tokens, in addition to the one every make owns implicitly.
+ * Returns 1 if the job is going to use the jobserver, 0 if there is no
+ * jobserver, or -1 on error.
+ */
+int
+jobserver_prepare_job(size_t nproc)
+{
+	if (pool_fds[0] < 0)
+		return 0;
+
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC)) {
+		perror_msg("pipe2");
+		return -1;
+	}
+
+	/*
+	 * The blocking mode is a property of the open file description,
+	 * and make expects the job pipe to be blocking, so the runner
+	 * opens the job pipe again.
+	 */
+	broker_fds[0] = reopen_nonblock(fds[0], O_RDONLY);
+	broker_fds[1] = reopen_nonblock(fds[1], O_WRONLY);
+	if (broker_fds[0] < 0 || broker_fds[1] < 0) {
+		xclose(&broker_fds[0]);
+		xclose(&broker_fds[1]);
+		xclose(&fds[0]);
+		xclose(&fds[1]);
+		return -1;
+	}
+
+	jobserver_rfd = fds[0];
+	jobserver_wfd = fds[1];
+	tokens_limit = nproc ? nproc - 1 : ULONG_MAX;
+	tokens_taken = 0;
+	last_batch = 0;
+
+	return 1;
+}
+
+int
+jobserver_active(void)
+{
+	return broker_fds[0] >= 0;
+}
+
+static unsigned long
+move_tokens(int from, int to, unsigned long count)
+{
+	char buf[64];
+	unsigned long moved = 0;
+
+	while (moved < count) {
+		size_t len = count - moved < sizeof(buf) ?
+			     count - moved : sizeof(buf);
+		ssize_t n = read(from, buf, len);
+		if (n <= 0)
+			break;
+
+		/* Whatever the job has written, the pool gets proper tokens. */
+		memset(buf, token, (size_t) n);
+		if (write(to, buf, (size_t) n) != n) {
+			perror_msg("jobserver: write");
+			break;
+		}
+		moved += (unsigned long) n;
+	}
+
+	return moved;
+}
+
+/*
+ * Called by the runner periodically.  If the job has used up all tokens
+ * handed over to it, hand over twice as many as last time, so that a job
+ * ramps up quickly, and if tokens pile up unused in the job pipe, give
+ * all of them but one back to the pool.
+ */
+void
+jobserver_balance(void)
+{
+	if (!jobserver_active())
+		return;
+
+	int avail = 0;
+	if (ioctl(broker_fds[0], FIONREAD, &avail) < 0)
+		return;
+
+	if (avail == 0) {
+		unsigned long want = last_batch ? last_batch * 2 : 1;
+
+		if (want > tokens_limit - tokens_taken)
+			want = tokens_limit - tokens_taken;
+		last_batch = move_tokens(pool_fds[0], broker_fds[1], want);
+		tokens_taken += last_batch;
+	} else {
+		last_batch = 0;
+		if (avail > 1) {
+			unsigned long extra = (unsigned long) avail - 1;
+
+			if (extra > tokens_taken)
+				extra = tokens_taken;
+			tokens_taken -= move_tokens(broker_fds[0], pool_fds[1],
+						    extra);
+		}
+	}
+}
+
+/* Return all tokens taken by the job to the pool. */
+void
+jobserver_release(void)
+{
+	if (!jobserver_active())
+		return;
+
+	for (; tokens_taken; --tokens_taken)
+		if (write(pool_fds[1], &token, 1) != 1) {
+			perror_msg("jobserver: write");
+			break;
+		}
+
+	xclose(&broker_fds[0]);
+	xclose(&broker_fds[1]);
+}
+
+/*
+ * Called in the job process before execve: make the job pipe available
+ * to the job and return the MAKEFLAGS environment variable referring
+ * to it, or NULL if the job does not use the jobserver.
+ * Both old and new names of the option are given, make ignores
+ * unknown options in MAKEFLAGS.
+ */
+char *
+jobserver_child_env(void)
+{
+	if (jobserver_rfd < 0 || jobserver_wfd < 0)
+		return NULL;
+
+	if (fcntl(jobserver_rfd, F_SETFD, 0) < 0 ||
+	    fcntl(jobserver_wfd, F_SETFD, 0) < 0)
+		perror_msg_and_die("fcntl F_SETFD");
+
+	return xasprintf("MAKEFLAGS= -j --jobserver-fds=%d,%d"
+			 " --jobserver-auth=%d,%d",
+			 jobserver_rfd, jobserver_wfd,
+			 jobserver_rfd, jobserver_wfd);
+}
@@ -0,0 +1,26 @@
+/*
+ * The host-wide make jobserver interface for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_JOBSERVER_H
+# define HASHER_JOBSERVER_H
+
+# include <stddef.h>
+
+/* How often the runner hands tokens over, in milliseconds. */
+# define JOBSERVER_TICK_MSEC	50
+
+int jobserver_check_tokens(unsigned long tokens);
+int jobserver_init(unsigned long tokens);
+int jobserver_prepare_job(size_t nproc);
+int jobserver_active(void);
+void jobserver_balance(void);
+void jobserver_release(void);
+char *jobserver_child_env(void);
+
+#endif /* !HASHER_JOBSERVER_H */
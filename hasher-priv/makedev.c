@@ -16,6 +16,7 @@
 #include "fds.h"
 #include "makedev.h"
 #include "mount.h"
+#include "mount_api.h"
 #include "unix.h"
 #include "xmalloc.h"
 #include <errno.h>
@@ -95,18 +96,13 @@ copy_dev(const char *src)
 	xmknod(name, dev_mode, major(st.st_rdev), minor(st.st_rdev));
 }
 
-void
-setup_devices(const char **vec, size_t len)
+/*
+ * Populate the current directory, which is the root of /dev,
+ * with the standard set of device files and the given devices.
+ */
+static void
+make_devices(int console, int pts, const char **vec, size_t len)
 {
-	gid_t   saved_gid = (gid_t) - 1;
-	mode_t  m;
-
-	fchdiruid(chroot_fd, stat_caller_ok_validator);
-	chdiruid("dev", stat_root_ok_validator);
-
-	ch_gid(0, &saved_gid);
-	m = umask(0);
-
 	xmkdir("pts", 0755);
 	xmkdir("shm", 0755);
 
@@ -121,22 +117,103 @@ setup_devices(const char **vec, size_t len)
 	xmknod("urandom", S_IFCHR | 0644, 1, 9);
 	xmknod("random", S_IFCHR | 0644, 1, 9);	/* pseudo random. */
 
-	if (makedev_console) {
+	if (console) {
 		xmknod("console", S_IFCHR | 0600, 5, 1);
 		xmknod("tty0", S_IFCHR | 0600, 4, 0);
 		xmknod("fb0", S_IFCHR | 0600, 29, 0);
 	}
 
-	if (dev_pts_mounted) {
+	if (pts) {
 		xmknod("tty", S_IFCHR | 0666, 5, 0);
 		xsymlink("pts/ptmx", "ptmx");
 	}
 
-	log_fd = log_listen();
-
 	for (size_t i = 0; i < len; ++i)
 		copy_dev(vec[i]);
+}
+
+void
+setup_devices(const char **vec, size_t len)
+{
+	gid_t   saved_gid = (gid_t) - 1;
+	mode_t  m;
+
+	fchdiruid(chroot_fd, stat_caller_ok_validator);
+	chdiruid("dev", stat_root_ok_validator);
+
+	ch_gid(0, &saved_gid);
+	m = umask(0);
+
+	make_devices(makedev_console, dev_pts_mounted, vec, len);
+
+	log_fd = log_listen("log");
 
 	umask(m);
 	ch_gid(saved_gid, 0);
 }
+
+/*
+ * Called by the session server: populate the current directory,
+ * which is the root of a new /dev template, the same way as
+ * setup_devices() does, except that the log socket is replaced
+ * with a placeholder for setup_dev_log().
+ */
+void
+make_dev_template(int console, int pts, const char **vec, size_t len)
+{
+	mode_t  m = umask(0);
+
+	make_devices(console, pts, vec, len);
+
+	int fd = open("log", O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW |
+			     O_CLOEXEC, 0622);
+	if (fd < 0)
+		perror_msg_and_die("%s", "log");
+	xclose(&fd);
+
+	umask(m);
+}
+
+/*
+ * The clone of a /dev template shares its contents with other jobs,
+ * so the log socket of the job is created in the mount template
+ * instead, where jobs cannot see it, and bound over the placeholder.
+ */
+void
+setup_dev_log(void)
+{
+	gid_t   saved_gid = (gid_t) - 1;
+
+	fchdiruid(chroot_fd, stat_caller_ok_validator);
+	chdiruid("dev", stat_root_ok_validator);
+
+	int     dir_fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd < 0)
+		perror_msg_and_die("open: %s", "dev");
+	if (fchdir(mount_tmpl_fd) < 0)
+		perror_msg_and_die("fchdir");
+
+	char   *name = xasprintf("log.%d", getpid());
+
+	ch_gid(0, &saved_gid);
+	mode_t  m = umask(0);
+	log_fd = log_listen(name);
+	umask(m);
+	ch_gid(saved_gid, 0);
+
+	if (log_fd >= 0) {
+		int     fd = sys_open_tree(mount_tmpl_fd, name,
+					   OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+		if (fd < 0)
+			perror_msg_and_die("open_tree: %s", name);
+		if (sys_move_mount(fd, "", dir_fd, "log",
+				   MOVE_MOUNT_F_EMPTY_PATH) < 0)
+			perror_msg_and_die("move_mount: %s", "log");
+		if (unlinkat(mount_tmpl_fd, name, 0) < 0)
+			perror_msg_and_die("unlink: %s", name);
+		xclose(&fd);
+	}
+
+	free(name);
+	xclose(&dir_fd);
+}
@@ -13,5 +13,7 @@
 # include <sys/types.h>
 
 void setup_devices(const char **vec, size_t len);
+void make_dev_template(int console, int pts, const char **vec, size_t len);
+void setup_dev_log(void);
 
 #endif /* !HASHER_MAKEDEV_H */
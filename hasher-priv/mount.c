@@ -17,6 +17,8 @@
 #include "macros.h"
 #include "makedev.h"
 #include "mount.h"
+#include "mount_api.h"
+#include "process.h"
 #include "xmalloc.h"
 #include <errno.h>
 #include <stdio.h>
@@ -28,24 +30,51 @@
 #include <grp.h>
 #include <mntent.h>
 #include <sys/mount.h>
+#include <sys/stat.h>
 
 int dev_pts_mounted;
 
+/* The proc instance mounted by setup_mountpoints(), if any. */
+static struct mnt_ent *proc_mounted;
+
+/*
+ * /dev templates are prepared for every combination of makedev_console,
+ * dev_pts_mounted, and the first DEV_TMPL_MAX_DEVICES allowed devices,
+ * see dev_template_mask().  The number of templates doubles with every
+ * device, so jobs requesting any other allowed device populate /dev
+ * themselves.
+ */
+#define DEV_TMPL_MAX_DEVICES	2
+#define DEV_TMPL_MAX		(4U << DEV_TMPL_MAX_DEVICES)
+
+/* Names of the prepared /dev templates in the mount template. */
+static char *dev_tmpl_names[DEV_TMPL_MAX];
+
+/* Parsed mount options, see prepare_mount_entry(). */
+struct mnt_prep
+{
+	unsigned long flags;
+	char *options;
+	/* The name of the prepared mount in the mount template, if any. */
+	char *tmpl_name;
+};
+
 static struct mnt_ent
 {
 	const char *mnt_fsname;
 	const char *mnt_dir;
 	const char *mnt_type;
 	const char *mnt_opts;
+	struct mnt_prep *prep;
 } def_fstab[] =
 {
-	{"dev", "/dev", "tmpfs", "nosuid,noexec,gid=0,mode=755,nr_blocks=0,nr_inodes=256"},
-	{"proc", "/proc", "proc", "ro,nosuid,nodev,noexec,gid=proc,hidepid=2"},
-	{"devpts", "/dev/pts", "devpts", "ro,nosuid,noexec,gid=tty,mode=0620,ptmxmode=0666,newinstance"},
-	{"sysfs", "/sys", "sysfs", "ro,nosuid,nodev,noexec"},
-	{"shmfs", "/dev/shm", "tmpfs", "nosuid,nodev,noexec,gid=0,mode=1777,nr_blocks=4096,nr_inodes=4096"},
-	{"/sys/fs/cgroup", "/sys/fs/cgroup", "rbind", "ro,rbind,nosuid,nodev,noexec"},
-	{SOCKETDIR, SOCKETDIR, "rbind", "rbind,nosuid,nodev,noexec"},
+	{"dev", "/dev", "tmpfs", "nosuid,noexec,gid=0,mode=755,nr_blocks=0,nr_inodes=256", 0},
+	{"proc", "/proc", "proc", "ro,nosuid,nodev,noexec,gid=proc,hidepid=2", 0},
+	{"devpts", "/dev/pts", "devpts", "ro,nosuid,noexec,gid=tty,mode=0620,ptmxmode=0666,newinstance", 0},
+	{"sysfs", "/sys", "sysfs", "ro,nosuid,nodev,noexec", 0},
+	{"shmfs", "/dev/shm", "tmpfs", "nosuid,nodev,noexec,gid=0,mode=1777,nr_blocks=4096,nr_inodes=4096", 0},
+	{"/sys/fs/cgroup", "/sys/fs/cgroup", "rbind", "ro,rbind,nosuid,nodev,noexec", 0},
+	{SOCKETDIR, SOCKETDIR, "rbind", "rbind,nosuid,nodev,noexec", 0},
 };
 
 #ifndef MS_MANDLOCK
@@ -69,9 +98,6 @@ static struct mnt_ent
 #ifndef MS_REC
 #define MS_REC		16384
 #endif
-#ifndef MS_SLAVE
-#define MS_SLAVE	(1 << 19)
-#endif
 
 static struct
 {
@@ -147,6 +173,177 @@ parse_opt(const char *opt, unsigned long *flags, char **options)
 	free(buf);
 }
 
+/*
+ * Parse mount options of the entry once, so that neither this
+ * nor group name lookups have to be repeated for every job.
+ */
+static void
+parse_mount_options(struct mnt_ent *e)
+{
+	char   *opt;
+	char   *buf = xstrdup(e->mnt_opts);
+
+	e->prep->flags = MS_MGC_VAL | MS_NOSUID;
+	for (opt = strtok(buf, ","); opt; opt = strtok(0, ","))
+		parse_opt(opt, &e->prep->flags, &e->prep->options);
+
+	free(buf);
+}
+
+static void
+prepare_mount_entry(struct mnt_ent *e)
+{
+	if (e->prep)
+		return;
+
+	e->prep = xzalloc(sizeof(*e->prep));
+	parse_mount_options(e);
+}
+
+static void
+reparse_mount_entry(struct mnt_ent *e)
+{
+	if (!e->prep)
+		return;
+
+	free(e->prep->options);
+	e->prep->options = 0;
+	parse_mount_options(e);
+}
+
+static unsigned int
+mount_attr_flags(unsigned long flags)
+{
+	unsigned int attr = 0;
+
+	if (flags & MS_RDONLY)
+		attr |= MOUNT_ATTR_RDONLY;
+	if (flags & MS_NOSUID)
+		attr |= MOUNT_ATTR_NOSUID;
+	if (flags & MS_NODEV)
+		attr |= MOUNT_ATTR_NODEV;
+	if (flags & MS_NOEXEC)
+		attr |= MOUNT_ATTR_NOEXEC;
+	if (flags & MS_NOATIME)
+		attr |= MOUNT_ATTR_NOATIME;
+	if (flags & MS_NODIRATIME)
+		attr |= MOUNT_ATTR_NODIRATIME;
+
+	return attr;
+}
+
+static int
+configure_fs(int fs_fd, const struct mnt_ent *e)
+{
+	if (sys_fsconfig(fs_fd, FSCONFIG_SET_STRING, "source",
+			 e->mnt_fsname, 0) < 0)
+		return -1;
+
+	if ((e->prep->flags & MS_RDONLY) &&
+	    sys_fsconfig(fs_fd, FSCONFIG_SET_FLAG, "ro", NULL, 0) < 0)
+		return -1;
+	if ((e->prep->flags & MS_SYNCHRONOUS) &&
+	    sys_fsconfig(fs_fd, FSCONFIG_SET_FLAG, "sync", NULL, 0) < 0)
+		return -1;
+	if ((e->prep->flags & MS_DIRSYNC) &&
+	    sys_fsconfig(fs_fd, FSCONFIG_SET_FLAG, "dirsync", NULL, 0) < 0)
+		return -1;
+
+	if (!e->prep->options)
+		return 0;
+
+	char   *buf = xstrdup(e->prep->options);
+	char   *opt, *value;
+	int     rc = 0;
+
+	for (opt = strtok(buf, ","); !rc && opt; opt = strtok(0, ",")) {
+		if ((value = strchr(opt, '='))) {
+			*value++ = '\0';
+			rc = sys_fsconfig(fs_fd, FSCONFIG_SET_STRING,
+					  opt, value, 0);
+		} else {
+			rc = sys_fsconfig(fs_fd, FSCONFIG_SET_FLAG,
+					  opt, NULL, 0);
+		}
+	}
+
+	free(buf);
+	return rc;
+}
+
+/*
+ * Create a detached mount described by the entry.
+ * Returns its descriptor, or -1 with errno set.
+ */
+static int
+create_mount(const struct mnt_ent *e)
+{
+	unsigned int attr = mount_attr_flags(e->prep->flags);
+	int     fd;
+
+	if (e->prep->flags & MS_BIND) {
+		unsigned int rec = (e->prep->flags & MS_REC) ? AT_RECURSIVE : 0;
+
+		fd = sys_open_tree(AT_FDCWD, e->mnt_fsname,
+				   OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | rec);
+		if (fd < 0)
+			return -1;
+
+		struct mount_attr_v0 ma = { .attr_set = attr };
+		if (sys_mount_setattr(fd, "", AT_EMPTY_PATH | rec, &ma) < 0) {
+			int saved_errno = errno;
+			xclose(&fd);
+			errno = saved_errno;
+			return -1;
+		}
+		return fd;
+	}
+
+	int     fs_fd = sys_fsopen(e->mnt_type, FSOPEN_CLOEXEC);
+	if (fs_fd < 0)
+		return -1;
+
+	if (configure_fs(fs_fd, e) < 0 ||
+	    sys_fsconfig(fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) < 0)
+		fd = -1;
+	else
+		fd = sys_fsmount(fs_fd, FSMOUNT_CLOEXEC, attr);
+
+	int saved_errno = errno;
+	xclose(&fs_fd);
+	errno = saved_errno;
+	return fd;
+}
+
+/*
+ * Attach the mount described by the entry to the current directory
+ * using the new mount API, cloning it from the mount template if possible.
+ * Returns 0 on success, -1 if the kernel does not support the new
+ * mount API.
+ */
+static int
+attach_mount(const struct mnt_ent *e)
+{
+	int     fd = -1;
+
+	if (e->prep->tmpl_name && mount_tmpl_fd >= 0)
+		fd = sys_open_tree(mount_tmpl_fd, e->prep->tmpl_name,
+				   OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC |
+				   AT_RECURSIVE);
+
+	if (fd < 0 && (fd = create_mount(e)) < 0) {
+		if (errno == ENOSYS)
+			return -1;
+		perror_msg_and_die("fsmount: %s", e->mnt_dir);
+	}
+
+	if (sys_move_mount(fd, "", AT_FDCWD, ".", MOVE_MOUNT_F_EMPTY_PATH))
+		perror_msg_and_die("move_mount: %s", e->mnt_dir);
+
+	xclose(&fd);
+	return 0;
+}
+
 static void
 xmount(struct mnt_ent *e)
 {
@@ -155,12 +352,7 @@ xmount(struct mnt_ent *e)
 		perror_msg_and_die("%s", e->mnt_dir);
 	}
 
-	char   *options = 0, *opt;
-	char   *buf = xstrdup(e->mnt_opts);
-	unsigned long flags = MS_MGC_VAL | MS_NOSUID;
-
-	for (opt = strtok(buf, ","); opt; opt = strtok(0, ","))
-		parse_opt(opt, &flags, &options);
+	prepare_mount_entry(e);
 
 	fchdiruid(chroot_fd, stat_caller_ok_validator);
 
@@ -169,15 +361,52 @@ xmount(struct mnt_ent *e)
 		 is_dev_subdir ? stat_root_ok_validator
 			       : stat_caller_rooter_ok_validator);
 
-	if (mount(e->mnt_fsname, ".", e->mnt_type, flags, options ? : ""))
+	if (use_mount_api && attach_mount(e) == 0)
+		return;
+
+	if (mount(e->mnt_fsname, ".", e->mnt_type, e->prep->flags,
+		  e->prep->options ? : ""))
 		perror_msg_and_die("mount: %s", e->mnt_dir);
+}
 
-	free(options);
-	free(buf);
+/*
+ * Attach a read-only clone of the named /dev template to the chroot.
+ * All clones of the template share its tmpfs superblock, so the clone
+ * is made read-only to keep any changes made to /dev by one job from
+ * showing up in other jobs.  A read-only mount does not get in the way
+ * of using /dev: device nodes can still be opened for writing, atime
+ * is not updated, and mounts on top of it, like /dev/pts, /dev/shm,
+ * and the log socket, are allowed.
+ * Returns 0 on success, or -1 if the clone cannot be made read-only,
+ * e.g. because the kernel does not support mount_setattr.
+ */
+static int
+attach_dev_template(const char *name)
+{
+	fchdiruid(chroot_fd, stat_caller_ok_validator);
+	chdiruid("dev", stat_caller_rooter_ok_validator);
+
+	int     fd = sys_open_tree(mount_tmpl_fd, name,
+				   OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+	if (fd < 0)
+		perror_msg_and_die("open_tree: %s", name);
+
+	struct mount_attr_v0 ma = { .attr_set = MOUNT_ATTR_RDONLY };
+	if (sys_mount_setattr(fd, "", AT_EMPTY_PATH, &ma) < 0) {
+		debug_msg("mount_setattr: %s: %m", name);
+		xclose(&fd);
+		return -1;
+	}
+
+	if (sys_move_mount(fd, "", AT_FDCWD, ".", MOVE_MOUNT_F_EMPTY_PATH))
+		perror_msg_and_die("move_mount: %s", "/dev");
+	xclose(&fd);
+	return 0;
 }
 
 static struct mnt_ent **var_fstab;
 static size_t var_fstab_size;
+static int fstab_loaded;
 
 static void
 fread_fstab(FILE *fp, const char *name ATTRIBUTE_UNUSED)
@@ -191,6 +420,7 @@ fread_fstab(FILE *fp, const char *name ATTRIBUTE_UNUSED)
 		e->mnt_dir = xstrdup(ent->mnt_dir);
 		e->mnt_type = xstrdup(ent->mnt_type);
 		e->mnt_opts = xstrdup(ent->mnt_opts);
+		e->prep = 0;
 
 		var_fstab = xreallocarray(var_fstab, var_fstab_size + 1,
 					  sizeof(*var_fstab));
@@ -198,9 +428,13 @@ fread_fstab(FILE *fp, const char *name ATTRIBUTE_UNUSED)
 	}
 }
 
-static void
-setup_fstab(void)
+void
+load_fstab(void)
 {
+	if (fstab_loaded)
+		return;
+	fstab_loaded = 1;
+
 	safe_chdir("/", stat_root_ok_validator);
 	safe_chdir("etc/hasher-priv", stat_root_ok_validator);
 	load_config("fstab", fread_fstab);
@@ -236,6 +470,273 @@ lookup_mount_entry(const char *mpoint)
 	return e;
 }
 
+/*
+ * Mounts that are safe to share between jobs, that is, proc
+ * (a job with a pid namespace of its own gets a new proc instance,
+ * see remount_proc()) and bind mounts with absolute source paths,
+ * are created in the mount template once per session and just cloned
+ * for every job.
+ */
+static int
+is_shareable_mount(const struct mnt_ent *e)
+{
+	if (e->prep->flags & MS_BIND)
+		return e->mnt_fsname[0] == '/';
+	return !strcmp(e->mnt_type, "proc");
+}
+
+static void
+add_template_mount(struct mnt_ent *e, unsigned int n)
+{
+	if (!is_shareable_mount(e))
+		return;
+
+	char   *name = xasprintf("%u", n);
+	int     fd = -1;
+
+	if (mkdirat(mount_tmpl_fd, name, 0700) < 0 ||
+	    (fd = create_mount(e)) < 0 ||
+	    sys_move_mount(fd, "", mount_tmpl_fd, name,
+			   MOVE_MOUNT_F_EMPTY_PATH) < 0) {
+		/*
+		 * Either the kernel does not support the new mount API,
+		 * or it does not support attaching a mount to a detached
+		 * mount tree.  Anyway, jobs will create this mount
+		 * themselves.
+		 */
+		debug_msg("mount template: %s: %m", e->mnt_dir);
+		free(name);
+	} else {
+		e->prep->tmpl_name = name;
+	}
+
+	xclose(&fd);
+}
+
+/*
+ * Returns the index of the /dev template for the given set of devices
+ * and the current makedev_console and dev_pts_mounted settings,
+ * or -1 if there cannot be such a template.
+ */
+static int
+dev_template_mask(const char **vec, size_t len)
+{
+	unsigned int mask = (makedev_console ? 1U : 0U) |
+			    (dev_pts_mounted ? 2U : 0U);
+
+	for (size_t i = 0; i < len; ++i) {
+		size_t j;
+
+		for (j = 0; j < DEV_TMPL_MAX_DEVICES &&
+			    j < allowed_devices.len; ++j)
+			if (allowed_devices.list[j] &&
+			    !strcmp(vec[i], allowed_devices.list[j]))
+				break;
+		if (j >= DEV_TMPL_MAX_DEVICES || j >= allowed_devices.len ||
+		    (mask & (4U << j)))
+			return -1;
+		mask |= 4U << j;
+	}
+
+	return (int) mask;
+}
+
+static char *
+dev_template_name(unsigned int mask)
+{
+	return xasprintf("dev.%u", mask);
+}
+
+ATTRIBUTE_NORETURN
+static void
+build_dev_templates(const struct mnt_ent *e, unsigned int n)
+{
+	for (unsigned int mask = 0; mask < n; ++mask) {
+		const char *vec[DEV_TMPL_MAX_DEVICES];
+		size_t len = 0;
+		int skip = 0;
+
+		for (size_t j = 0; j < DEV_TMPL_MAX_DEVICES; ++j) {
+			if (!(mask & (4U << j)))
+				continue;
+			if (!allowed_devices.list[j])
+				skip = 1;
+			else
+				vec[len++] = allowed_devices.list[j];
+		}
+		if (skip)
+			continue;
+
+		int fd = create_mount(e);
+		if (fd < 0)
+			perror_msg_and_die("fsmount: %s", e->mnt_dir);
+		if (fchdir(fd) < 0)
+			perror_msg_and_die("fchdir");
+
+		make_dev_template(mask & 1U, mask & 2U, vec, len);
+
+		char *name = dev_template_name(mask);
+		if (mkdirat(mount_tmpl_fd, name, 0700) < 0 ||
+		    sys_move_mount(fd, "", mount_tmpl_fd, name,
+				   MOVE_MOUNT_F_EMPTY_PATH) < 0)
+			perror_msg_and_die("move_mount: %s", name);
+		free(name);
+		xclose(&fd);
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * Prepare /dev templates in the mount template, so that jobs
+ * just clone them instead of populating /dev every time.
+ * Templates are built in a child process because populating
+ * them may fail, e.g. if an allowed device does not exist,
+ * and then only the templates built so far are used.
+ */
+static void
+prepare_dev_templates(void)
+{
+	struct mnt_ent *e = lookup_mount_entry("/dev");
+
+	/* A bind mounted /dev cannot be shared between jobs. */
+	if (e->prep->flags & MS_BIND)
+		return;
+
+	size_t  ndev = allowed_devices.len < DEV_TMPL_MAX_DEVICES
+		? allowed_devices.len : DEV_TMPL_MAX_DEVICES;
+	unsigned int n = 4U << ndev;
+
+	pid_t   pid = fork();
+	if (pid < 0) {
+		perror_msg("fork");
+		return;
+	}
+	if (!pid)
+		build_dev_templates(e, n);
+	(void) waitpid_retry(pid, NULL, 0);
+
+	for (unsigned int mask = 0; mask < n; ++mask) {
+		char   *name = dev_template_name(mask);
+		char   *path = xasprintf("%s/null", name);
+		struct stat st;
+
+		if (fstatat(mount_tmpl_fd, path, &st, AT_SYMLINK_NOFOLLOW))
+			free(name);
+		else
+			dev_tmpl_names[mask] = name;
+		free(path);
+	}
+}
+
+/*
+ * Called by the session server: load fstab and parse mount options,
+ * and if mount_api is enabled, prepare the mount template.
+ */
+void
+prepare_mountpoints(void)
+{
+	load_fstab();
+
+	for (size_t i = 0; i < ARRAY_SIZE(def_fstab); ++i)
+		prepare_mount_entry(&def_fstab[i]);
+	for (size_t i = 0; i < var_fstab_size; ++i)
+		prepare_mount_entry(var_fstab[i]);
+
+	endgrent();
+
+	if (!use_mount_api)
+		return;
+
+	int     fs_fd = sys_fsopen("tmpfs", FSOPEN_CLOEXEC);
+	if (fs_fd < 0) {
+		debug_msg("mount template: fsopen: %m");
+		return;
+	}
+	if (sys_fsconfig(fs_fd, FSCONFIG_SET_STRING, "mode", "700", 0) < 0 ||
+	    sys_fsconfig(fs_fd, FSCONFIG_SET_STRING, "size", "1m", 0) < 0 ||
+	    sys_fsconfig(fs_fd, FSCONFIG_SET_STRING, "nr_inodes", "256", 0) < 0 ||
+	    sys_fsconfig(fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) < 0 ||
+	    (mount_tmpl_fd = sys_fsmount(fs_fd, FSMOUNT_CLOEXEC,
+					 MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV |
+					 MOUNT_ATTR_NOEXEC)) < 0) {
+		debug_msg("mount template: %m");
+		xclose(&fs_fd);
+		return;
+	}
+	xclose(&fs_fd);
+
+	unsigned int n = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(def_fstab); ++i)
+		add_template_mount(&def_fstab[i], n++);
+	for (size_t i = 0; i < var_fstab_size; ++i)
+		add_template_mount(var_fstab[i], n++);
+
+	prepare_dev_templates();
+}
+
+static void
+free_mount_prep(struct mnt_ent *e)
+{
+	if (!e->prep)
+		return;
+
+	free(e->prep->options);
+	free(e->prep->tmpl_name);
+	free(e->prep);
+	e->prep = 0;
+}
+
+/*
+ * Called by the session server before the configuration is loaded
+ * again: forget fstab, parsed mount options, and the mount template.
+ */
+void
+release_mountpoints(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(def_fstab); ++i)
+		free_mount_prep(&def_fstab[i]);
+
+	for (size_t i = 0; i < var_fstab_size; ++i) {
+		struct mnt_ent *e = var_fstab[i];
+
+		free_mount_prep(e);
+		free((char *) e->mnt_fsname);
+		free((char *) e->mnt_dir);
+		free((char *) e->mnt_type);
+		free((char *) e->mnt_opts);
+		free(e);
+	}
+	free(var_fstab);
+	var_fstab = 0;
+	var_fstab_size = 0;
+	fstab_loaded = 0;
+	proc_mounted = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(dev_tmpl_names); ++i) {
+		free(dev_tmpl_names[i]);
+		dev_tmpl_names[i] = 0;
+	}
+
+	xclose(&mount_tmpl_fd);
+}
+
+/*
+ * Called by the session server when the group database has changed:
+ * parse mount options again to pick up new ids of group names.
+ * Mounts already created in the mount template are left intact.
+ */
+void
+refresh_mount_options(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(def_fstab); ++i)
+		reparse_mount_entry(&def_fstab[i]);
+	for (size_t i = 0; i < var_fstab_size; ++i)
+		reparse_mount_entry(var_fstab[i]);
+
+	endgrent();
+}
+
 /* called by unshare_mount() after successful CLONE_NEWNS */
 void
 setup_mountpoints(void)
@@ -288,25 +789,51 @@ setup_mountpoints(void)
 		}
 	}
 
-	/*
-	 * Just in case that some filesystem is mounted as shared,
-	 * remount it as slave in our namespace so that
-	 * no further mounts show up outside.
-	 */
-	if (mount("/", "/", NULL, MS_SLAVE | MS_REC, NULL) < 0 &&
-	    errno != EINVAL)
-		perror_msg_and_die("mount MS_SLAVE");
-
-	setup_fstab();
-
-	xmount(lookup_mount_entry("/dev"));
+	load_fstab();
 
-	setup_devices(dev_vec, dev_size);
+	int dev_mask = dev_template_mask(dev_vec, dev_size);
+	if (dev_mask >= 0 && dev_tmpl_names[dev_mask] &&
+	    attach_dev_template(dev_tmpl_names[dev_mask]) == 0) {
+		setup_dev_log();
+	} else {
+		xmount(lookup_mount_entry("/dev"));
+		setup_devices(dev_vec, dev_size);
+	}
 
 	xmount(lookup_mount_entry("/dev/shm"));
-	for (size_t i = 0; i < mpoint_size; ++i)
-		xmount(lookup_mount_entry(mpoint_vec[i]));
+	for (size_t i = 0; i < mpoint_size; ++i) {
+		struct mnt_ent *e = lookup_mount_entry(mpoint_vec[i]);
+
+		xmount(e);
+		if (!strcmp(e->mnt_dir, "/proc") &&
+		    !strcmp(e->mnt_type, "proc") &&
+		    !(e->prep->flags & MS_BIND))
+			proc_mounted = e;
+	}
+
+	xclose(&mount_tmpl_fd);
 
 	free(dev_vec);
 	free(mpoint_vec);
 }
+
+/*
+ * Replace the proc instance mounted by setup_mountpoints(), if any,
+ * with a new one that shows the pid namespace of the job.
+ * Called by the init of that namespace inside the chroot.
+ */
+void
+remount_proc(void)
+{
+	struct mnt_ent *e = proc_mounted;
+
+	if (!e)
+		return;
+
+	if (umount2(e->mnt_dir, MNT_DETACH) < 0)
+		perror_msg_and_die("umount2: %s", e->mnt_dir);
+
+	if (mount(e->mnt_fsname, e->mnt_dir, e->mnt_type, e->prep->flags,
+		  e->prep->options ? : ""))
+		perror_msg_and_die("mount: %s", e->mnt_dir);
+}
@@ -10,6 +10,11 @@
 #ifndef HASHER_MOUNT_H
 # define HASHER_MOUNT_H
 
+void load_fstab(void);
+void prepare_mountpoints(void);
+void release_mountpoints(void);
+void refresh_mount_options(void);
+void remount_proc(void);
 void setup_mountpoints(void);
 
 extern int dev_pts_mounted;
@@ -0,0 +1,124 @@
+/*
+ * The new mount API wrappers for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root privileges. */
+
+#include "cc_compat.h"
+#include "mount_api.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+/*
+ * These are called via syscall(2) because not all supported versions
+ * of libc provide wrappers for them.  Without syscall numbers, they fail
+ * with ENOSYS, just like on a kernel that does not implement them.
+ */
+#if defined __NR_fsopen && defined __NR_fsconfig && defined __NR_fsmount \
+ && defined __NR_move_mount && defined __NR_open_tree \
+ && defined __NR_mount_setattr
+
+int
+sys_fsopen(const char *fs_name, unsigned int flags)
+{
+	return (int) syscall(__NR_fsopen, fs_name, flags);
+}
+
+int
+sys_fsconfig(int fs_fd, unsigned int cmd, const char *key,
+	     const void *value, int aux)
+{
+	return (int) syscall(__NR_fsconfig, fs_fd, cmd, key, value, aux);
+}
+
+int
+sys_fsmount(int fs_fd, unsigned int flags, unsigned int attr_flags)
+{
+	return (int) syscall(__NR_fsmount, fs_fd, flags, attr_flags);
+}
+
+int
+sys_move_mount(int from_dfd, const char *from_path,
+	       int to_dfd, const char *to_path, unsigned int flags)
+{
+	return (int) syscall(__NR_move_mount, from_dfd, from_path,
+			     to_dfd, to_path, flags);
+}
+
+int
+sys_open_tree(int dfd, const char *path, unsigned int flags)
+{
+	return (int) syscall(__NR_open_tree, dfd, path, flags);
+}
+
+int
+sys_mount_setattr(int dfd, const char *path, unsigned int flags,
+		  struct mount_attr_v0 *attr)
+{
+	return (int) syscall(__NR_mount_setattr, dfd, path, flags,
+			     attr, sizeof(*attr));
+}
+
+#else
+
+int
+sys_fsopen(const char *fs_name ATTRIBUTE_UNUSED,
+	   unsigned int flags ATTRIBUTE_UNUSED)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+sys_fsconfig(int fs_fd ATTRIBUTE_UNUSED, unsigned int cmd ATTRIBUTE_UNUSED,
+	     const char *key ATTRIBUTE_UNUSED,
+	     const void *value ATTRIBUTE_UNUSED, int aux ATTRIBUTE_UNUSED)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+sys_fsmount(int fs_fd ATTRIBUTE_UNUSED, unsigned int flags ATTRIBUTE_UNUSED,
+	    unsigned int attr_flags ATTRIBUTE_UNUSED)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+sys_move_mount(int from_dfd ATTRIBUTE_UNUSED,
+	       const char *from_path ATTRIBUTE_UNUSED,
+	       int to_dfd ATTRIBUTE_UNUSED,
+	       const char *to_path ATTRIBUTE_UNUSED,
+	       unsigned int flags ATTRIBUTE_UNUSED)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+sys_open_tree(int dfd ATTRIBUTE_UNUSED, const char *path ATTRIBUTE_UNUSED,
+	      unsigned int flags ATTRIBUTE_UNUSED)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+int
+sys_mount_setattr(int dfd ATTRIBUTE_UNUSED, const char *path ATTRIBUTE_UNUSED,
+		  unsigned int flags ATTRIBUTE_UNUSED,
+		  struct mount_attr_v0 *attr ATTRIBUTE_UNUSED)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * The new mount API wrappers for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_MOUNT_API_H
+# define HASHER_MOUNT_API_H
+
+# include <fcntl.h>
+# include <stdint.h>
+# include <sys/mount.h>
+
+# ifndef FSOPEN_CLOEXEC
+#  define FSOPEN_CLOEXEC	0x00000001
+# endif
+# ifndef FSMOUNT_CLOEXEC
+#  define FSMOUNT_CLOEXEC	0x00000001
+# endif
+# ifndef FSCONFIG_SET_FLAG
+#  define FSCONFIG_SET_FLAG	0
+#  define FSCONFIG_SET_STRING	1
+#  define FSCONFIG_CMD_CREATE	6
+# endif
+# ifndef OPEN_TREE_CLONE
+#  define OPEN_TREE_CLONE	1
+# endif
+# ifndef OPEN_TREE_CLOEXEC
+#  define OPEN_TREE_CLOEXEC	O_CLOEXEC
+# endif
+# ifndef MOVE_MOUNT_F_EMPTY_PATH
+#  define MOVE_MOUNT_F_EMPTY_PATH	0x00000004
+# endif
+# ifndef MOUNT_ATTR_RDONLY
+#  define MOUNT_ATTR_RDONLY	0x00000001
+#  define MOUNT_ATTR_NOSUID	0x00000002
+#  define MOUNT_ATTR_NODEV	0x00000004
+#  define MOUNT_ATTR_NOEXEC	0x00000008
+#  define MOUNT_ATTR_NOATIME	0x00000010
+#  define MOUNT_ATTR_NODIRATIME	0x00000080
+# endif
+# ifndef AT_RECURSIVE
+#  define AT_RECURSIVE	0x8000
+# endif
+
+/* Layout of struct mount_attr, see mount_setattr(2). */
+struct mount_attr_v0 {
+	uint64_t attr_set;
+	uint64_t attr_clr;
+	uint64_t propagation;
+	uint64_t userns_fd;
+};
+
+int sys_fsopen(const char *fs_name, unsigned int flags);
+int sys_fsconfig(int fs_fd, unsigned int cmd, const char *key,
+		 const void *value, int aux);
+int sys_fsmount(int fs_fd, unsigned int flags, unsigned int attr_flags);
+int sys_move_mount(int from_dfd, const char *from_path,
+		   int to_dfd, const char *to_path, unsigned int flags);
+int sys_open_tree(int dfd, const char *path, unsigned int flags);
+int sys_mount_setattr(int dfd, const char *path, unsigned int flags,
+		      struct mount_attr_v0 *attr);
+
+#endif /* !HASHER_MOUNT_API_H */
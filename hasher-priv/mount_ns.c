@@ -0,0 +1,361 @@
+/*
+ * The mount namespace setup for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root privileges. */
+
+#include "caller_config.h"
+#include "caller_data.h"
+#include "chdir.h"
+#include "error_prints.h"
+#include "fds.h"
+#include "image.h"
+#include "macros.h"
+#include "mount_api.h"
+#include "mount_ns.h"
+#include "overlay.h"
+#include "pass.h"
+#include "process.h"
+#include "signals.h"
+#include "title.h"
+#include "unshare.h"
+#include "xmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/*
+ * The minimal mount namespace template consists of a tmpfs root
+ * with clones of the few host mounts the job setup needs before
+ * it enters the chroot: /dev for ptys and loop devices, /proc for
+ * overlay layers, and /tmp/.X11-unix for X11 forwarding.
+ * Every job stacks a tmpfs of its own on top of the root of the copy
+ * of the template, moves these mounts onto it, and attaches the chroot
+ * at the same path it has in the server's mount namespace, so that the
+ * chroot passes the same prefix checks as in the server's namespace.
+ * The chroot becomes the root of the job's mount namespace, so neither
+ * creating this namespace nor tearing it down depends on the number of
+ * host mounts, and the directories created for the chroot go away along
+ * with the job instead of piling up in the template.
+ */
+static const struct {
+	const char *path;
+	unsigned int flags;
+	int optional;
+} tmpl_mounts[] = {
+	{ "/dev", AT_RECURSIVE, 0 },
+	{ "/proc", 0, 0 },
+	{ "/tmp/.X11-unix", 0, 1 },
+};
+
+/*
+ * Both the template and the per-job tmpfs hold just a few directories,
+ * the size limit keeps them from growing anyway.
+ */
+#define MOUNTPOINTS_TMPFS_SIZE	"1m"
+
+/* Set when the chroot is to be entered using pivot_root. */
+static int use_pivot_root;
+
+static int
+sys_pivot_root(const char *new_root, const char *put_old)
+{
+	return (int) syscall(__NR_pivot_root, new_root, put_old);
+}
+
+/*
+ * Create all missing directories of the given absolute path
+ * beneath the given directory.
+ */
+static void
+make_path(int dir_fd, const char *path)
+{
+	char *p = xstrdup(path);
+
+	for (char *s = strchr(p + 1, '/'); ; s = strchr(s + 1, '/')) {
+		if (s)
+			*s = '\0';
+		if (mkdirat(dir_fd, p + 1, 0755) < 0 && errno != EEXIST)
+			perror_msg_and_die("mkdir: %s", p);
+		if (!s)
+			break;
+		*s = '/';
+	}
+
+	free(p);
+}
+
+/*
+ * Make the current directory the root of the mount namespace
+ * and detach the old root.
+ */
+static void
+pivot_to_cwd(void)
+{
+	if (sys_pivot_root(".", ".") < 0)
+		perror_msg_and_die("pivot_root");
+	if (umount2(".", MNT_DETACH) < 0)
+		perror_msg_and_die("umount2");
+	if (chdir("/") < 0)
+		perror_msg_and_die("chdir: %s", "/");
+}
+
+/* Create a detached tmpfs suitable for holding mount points. */
+static int
+create_mountpoints_tmpfs(void)
+{
+	int fs_fd = sys_fsopen("tmpfs", FSOPEN_CLOEXEC);
+	if (fs_fd < 0 ||
+	    sys_fsconfig(fs_fd, FSCONFIG_SET_STRING, "mode", "755", 0) < 0 ||
+	    sys_fsconfig(fs_fd, FSCONFIG_SET_STRING, "size",
+			 MOUNTPOINTS_TMPFS_SIZE, 0) < 0 ||
+	    sys_fsconfig(fs_fd, FSCONFIG_CMD_CREATE, NULL, NULL, 0) < 0)
+		perror_msg_and_die("tmpfs");
+	int fd = sys_fsmount(fs_fd, FSMOUNT_CLOEXEC,
+			     MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV |
+			     MOUNT_ATTR_NOEXEC);
+	if (fd < 0)
+		perror_msg_and_die("fsmount");
+	xclose(&fs_fd);
+
+	return fd;
+}
+
+/*
+ * Move the mounts referred to by fds to their paths
+ * beneath the given directory.
+ */
+static void
+move_tmpl_mounts(int *fds, int dir_fd)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(tmpl_mounts); ++i) {
+		if (fds[i] < 0)
+			continue;
+		make_path(dir_fd, tmpl_mounts[i].path);
+		if (sys_move_mount(fds[i], "", dir_fd, tmpl_mounts[i].path + 1,
+				   MOVE_MOUNT_F_EMPTY_PATH) < 0)
+			perror_msg_and_die("move_mount: %s",
+					   tmpl_mounts[i].path);
+		xclose(&fds[i]);
+	}
+}
+
+ATTRIBUTE_NORETURN
+static void
+create_template(int sock)
+{
+	setproctitle("mntns %s/%u:%u", caller_user, caller_uid, caller_num);
+
+	/*
+	 * As we are not going to handle signals, unblock them.
+	 */
+	unblock_all_signals();
+
+	if (unshare(CLONE_NEWNS) < 0)
+		perror_msg_and_die("unshare: %s", "CLONE_NEWNS");
+	if (mount(NULL, "/", NULL, MS_PRIVATE | MS_REC, NULL) < 0)
+		perror_msg_and_die("mount MS_PRIVATE");
+
+	int fds[ARRAY_SIZE(tmpl_mounts)];
+	for (size_t i = 0; i < ARRAY_SIZE(tmpl_mounts); ++i) {
+		fds[i] = sys_open_tree(AT_FDCWD, tmpl_mounts[i].path,
+				       OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC |
+				       tmpl_mounts[i].flags);
+		if (fds[i] < 0 &&
+		    !(tmpl_mounts[i].optional && errno == ENOENT))
+			perror_msg_and_die("open_tree: %s",
+					   tmpl_mounts[i].path);
+	}
+
+	int root_fd = create_mountpoints_tmpfs();
+
+	/* Stack the tmpfs on top of the root and make it the new root. */
+	if (sys_move_mount(root_fd, "", AT_FDCWD, "/",
+			   MOVE_MOUNT_F_EMPTY_PATH) < 0)
+		perror_msg_and_die("move_mount: %s", "/");
+	if (fchdir(root_fd) < 0)
+		perror_msg_and_die("fchdir");
+	pivot_to_cwd();
+	xclose(&root_fd);
+
+	move_tmpl_mounts(fds, AT_FDCWD);
+
+	int fd = open("/proc/self/ns/mnt", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		perror_msg_and_die("open: %s", "/proc/self/ns/mnt");
+
+	fd_send(sock, &fd, 1, NULL, 0);
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * Called by the session server: if minimal_mount_ns is enabled,
+ * create the mount namespace template and keep it open as mntns_fd,
+ * replacing the previous one, if any.
+ * On failure, jobs fall back to copying the mount namespace.
+ */
+void
+prepare_mount_ns(void)
+{
+	xclose(&mntns_fd);
+
+	if (!use_minimal_mount_ns)
+		return;
+
+	/* Bind mounts cannot be made from the host in the minimal root. */
+	if (mount_tmpl_fd < 0) {
+		error_msg("%s/%u:%u: minimal mount namespace requires"
+			  " the mount template, see mount_api",
+			  caller_user, caller_uid, caller_num);
+		return;
+	}
+
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+		perror_msg("socketpair");
+		return;
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror_msg("fork");
+	} else if (!pid) {
+		xclose(&sv[0]);
+		create_template(sv[1]);
+	} else {
+		xclose(&sv[1]);
+		if (fd_recv(sv[0], &mntns_fd, 1, NULL, 0) < 0) {
+			mntns_fd = -1;
+			error_msg("%s/%u:%u: failed to create mount namespace"
+				  " template", caller_user, caller_uid,
+				  caller_num);
+		}
+		(void) waitpid_retry(pid, NULL, 0);
+	}
+
+	xclose(&sv[0]);
+	xclose(&sv[1]);
+}
+
+/*
+ * Create a detached mount to be used as the root of the chroot
+ * if the chroot directory is to be replaced, or -1 otherwise.
+ */
+static int
+create_chroot_mount(void)
+{
+	if (image_fd >= 0)
+		return create_image_overlay();
+
+	/*
+	 * Like the image, the overlay is writable by the caller,
+	 * so neither set-user-ID programs nor devices are trusted.
+	 */
+	if (chroot_overlay)
+		return create_overlay(-1, MOUNT_ATTR_NOSUID | MOUNT_ATTR_NODEV);
+	return -1;
+}
+
+/*
+ * Set up a private mount namespace for the chroot directory,
+ * which is the current directory, and change to the chroot
+ * in that namespace.
+ */
+void
+setup_mount_ns(void)
+{
+	int root_fd = create_chroot_mount();
+
+	if (mntns_fd < 0) {
+		unshare_mount();
+		if (root_fd >= 0 &&
+		    sys_move_mount(root_fd, "", AT_FDCWD, ".",
+				   MOVE_MOUNT_F_EMPTY_PATH) < 0)
+			perror_msg_and_die("move_mount");
+	} else {
+		if (root_fd < 0) {
+			root_fd = sys_open_tree(AT_FDCWD, ".",
+						OPEN_TREE_CLONE |
+						OPEN_TREE_CLOEXEC |
+						AT_RECURSIVE);
+			if (root_fd < 0)
+				perror_msg_and_die("open_tree");
+		}
+
+		char *path = getcwd(NULL, 0);
+		if (!path)
+			perror_msg_and_die("getcwd");
+
+		/* setns() also changes to the root of the namespace. */
+		if (setns(mntns_fd, CLONE_NEWNS) < 0)
+			perror_msg_and_die("setns: %s", "mnt");
+		xclose(&mntns_fd);
+		if (unshare(CLONE_NEWNS) < 0)
+			perror_msg_and_die("unshare: %s", "CLONE_NEWNS");
+
+		/*
+		 * Stack a tmpfs of the job on top of the root, move the
+		 * template mounts onto it, and make it the new root.
+		 */
+		int fds[ARRAY_SIZE(tmpl_mounts)];
+		for (size_t i = 0; i < ARRAY_SIZE(tmpl_mounts); ++i) {
+			fds[i] = sys_open_tree(AT_FDCWD, tmpl_mounts[i].path,
+					       OPEN_TREE_CLOEXEC);
+			if (fds[i] < 0 &&
+			    !(tmpl_mounts[i].optional && errno == ENOENT))
+				perror_msg_and_die("open_tree: %s",
+						   tmpl_mounts[i].path);
+		}
+
+		int job_fd = create_mountpoints_tmpfs();
+		if (sys_move_mount(job_fd, "", AT_FDCWD, "/",
+				   MOVE_MOUNT_F_EMPTY_PATH) < 0)
+			perror_msg_and_die("move_mount: %s", "/");
+		move_tmpl_mounts(fds, job_fd);
+		if (fchdir(job_fd) < 0)
+			perror_msg_and_die("fchdir");
+		pivot_to_cwd();
+		xclose(&job_fd);
+
+		make_path(AT_FDCWD, path);
+		if (sys_move_mount(root_fd, "", AT_FDCWD, path,
+				   MOVE_MOUNT_F_EMPTY_PATH) < 0)
+			perror_msg_and_die("move_mount: %s", path);
+		free(path);
+
+		use_pivot_root = 1;
+	}
+
+	if (root_fd >= 0) {
+		safe_fchdir(root_fd, stat_caller_ok_validator);
+		xclose(&root_fd);
+	}
+}
+
+/*
+ * Change the root to the current directory, which is the chroot.
+ * In the minimal mount namespace, also detach everything else.
+ */
+void
+enter_chroot(void)
+{
+	if (use_pivot_root)
+		pivot_to_cwd();
+	else if (chroot(".") < 0)
+		perror_msg_and_die("chroot");
+}
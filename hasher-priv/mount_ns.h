@@ -0,0 +1,17 @@
+/*
+ * The mount namespace setup for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_MOUNT_NS_H
+# define HASHER_MOUNT_NS_H
+
+void prepare_mount_ns(void);
+void setup_mount_ns(void);
+void enter_chroot(void);
+
+#endif /* !HASHER_MOUNT_NS_H */
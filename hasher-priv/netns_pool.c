@@ -0,0 +1,202 @@
+/*
+ * The pool of network namespaces for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root privileges. */
+
+#include "caller_data.h"
+#include "error_prints.h"
+#include "fds.h"
+#include "net.h"
+#include "netns_pool.h"
+#include "pass.h"
+#include "server_config.h"
+#include "signals.h"
+#include "title.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <linux/sockios.h>
+
+/*
+ * Ready network namespaces are kept in the receive queue of a
+ * SOCK_SEQPACKET socket pair, one descriptor per one byte message,
+ * so that the number of bytes queued is the number of namespaces
+ * in the pool and job handlers can take them without consulting
+ * the session server.
+ */
+static int pool_fds[2] = { -1, -1 };
+
+/* The process that creates network namespaces for the pool. */
+static pid_t refiller_pid;
+
+int
+netns_pool_init(void)
+{
+	if (!server_netns_pool_size)
+		return 0;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pool_fds)) {
+		perror_msg("socketpair");
+		return -1;
+	}
+
+	netns_pool_refill();
+	return 0;
+}
+
+static unsigned long
+netns_pool_count(void)
+{
+	int n;
+
+	if (ioctl(pool_fds[0], SIOCINQ, &n) < 0) {
+		perror_msg("ioctl SIOCINQ");
+		return server_netns_pool_size;
+	}
+
+	return (unsigned long) n;
+}
+
+ATTRIBUTE_NORETURN
+static void
+netns_refiller(unsigned long n)
+{
+	setproctitle("netns %s/%u:%u", caller_user, caller_uid, caller_num);
+
+	/*
+	 * As we are not going to handle signals, unblock them.
+	 */
+	unblock_all_signals();
+
+	xclose(&pool_fds[0]);
+
+	while (n--) {
+		if (unshare(CLONE_NEWNET) < 0)
+			perror_msg_and_die("unshare: %s", "CLONE_NEWNET");
+
+		setup_network();
+
+		int fd = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			perror_msg_and_die("open: %s", "/proc/self/ns/net");
+
+		fd_send(pool_fds[1], &fd, 1, NULL, 0);
+		xclose(&fd);
+	}
+
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * Start creating new network namespaces in a separate process
+ * if the pool is not full and no such process is running yet.
+ */
+void
+netns_pool_refill(void)
+{
+	if (pool_fds[0] < 0 || refiller_pid > 0)
+		return;
+
+	unsigned long n = netns_pool_count();
+	if (n >= server_netns_pool_size)
+		return;
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror_msg("fork");
+		return;
+	}
+	if (!pid)
+		netns_refiller(server_netns_pool_size - n);
+
+	refiller_pid = pid;
+}
+
+/*
+ * Returns 1 if the given process was the pool refiller, 0 otherwise.
+ */
+int
+netns_pool_reaped(pid_t pid, int status)
+{
+	if (!refiller_pid || pid != refiller_pid)
+		return 0;
+
+	refiller_pid = 0;
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+		return 1;
+
+	/*
+	 * Most likely, network namespaces cannot be created at all,
+	 * jobs will report this themselves, so stop refilling the pool.
+	 */
+	error_msg("%s/%u:%u: netns pool refiller %d failed, pool disabled",
+		  caller_user, caller_uid, caller_num, pid);
+	netns_pool_close();
+	return 1;
+}
+
+/*
+ * Returns a descriptor of a network namespace taken from the pool,
+ * or -1 if the pool is empty.
+ */
+int
+netns_pool_take(void)
+{
+	if (pool_fds[0] < 0)
+		return -1;
+
+	char data;
+	struct iovec iov = {
+		.iov_base = &data,
+		.iov_len = sizeof(data)
+	};
+	char buf[CMSG_SPACE(sizeof(int))]
+		__attribute__((__aligned__(__alignof__(struct cmsghdr))));
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = buf,
+		.msg_controllen = sizeof(buf)
+	};
+
+	if (recvmsg(pool_fds[0], &msg,
+		    MSG_DONTWAIT | MSG_CMSG_CLOEXEC) != sizeof(data)) {
+		if (errno != EAGAIN)
+			perror_msg("recvmsg");
+		return -1;
+	}
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg ||
+	    cmsg->cmsg_level != SOL_SOCKET ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+		return -1;
+
+	int fd;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+	return fd;
+}
+
+void
+netns_pool_close(void)
+{
+	xclose(&pool_fds[0]);
+	xclose(&pool_fds[1]);
+}
@@ -0,0 +1,21 @@
+/*
+ * The pool of network namespaces for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_NETNS_POOL_H
+# define HASHER_NETNS_POOL_H
+
+# include <sys/types.h>
+
+int netns_pool_init(void);
+void netns_pool_refill(void);
+int netns_pool_reaped(pid_t, int status);
+int netns_pool_take(void);
+void netns_pool_close(void);
+
+#endif /* !HASHER_NETNS_POOL_H */
@@ -0,0 +1,152 @@
+/*
+ * The overlay chroot setup for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root privileges. */
+
+#include "caller_config.h"
+#include "chdir.h"
+#include "error_prints.h"
+#include "fds.h"
+#include "mount_api.h"
+#include "overlay.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static int
+open_path(int dir_fd, const char *name)
+{
+	int fd = openat(dir_fd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		perror_msg_and_die("open: %s", name);
+	return fd;
+}
+
+static void
+check_mount_api(int rc, const char *what)
+{
+	if (rc >= 0)
+		return;
+	if (errno == ENOSYS)
+		perror_msg_and_die("overlay: the new mount API"
+				   " is not supported by the kernel");
+	perror_msg_and_die("overlay: %s", what);
+}
+
+/*
+ * Open upper and work directories in the caller-provided
+ * chroot_overlay_dir.
+ */
+static void
+open_overlay_dir(int *upper_fd, int *work_fd)
+{
+	chdiruid(chroot_overlay_dir, stat_caller_ok_validator);
+	int dir_fd = open_path(AT_FDCWD, ".");
+
+	safe_chdir("upper", stat_caller_ok_validator);
+	*upper_fd = open_path(AT_FDCWD, ".");
+
+	safe_fchdir(dir_fd, stat_caller_ok_validator);
+	safe_chdir("work", stat_caller_ok_validator);
+	*work_fd = open_path(AT_FDCWD, ".");
+
+	xclose(&dir_fd);
+}
+
+/*
+ * Create upper and work directories on a fresh tmpfs
+ * which is discarded along with the mount namespace.
+ * The root of the overlay inherits ownership and permissions
+ * of the upper directory, so copy them from the chroot directory.
+ * Returns the descriptor of the tmpfs mount which has to be kept open
+ * until the overlay is created.
+ */
+static int
+create_overlay_tmpfs(const struct stat *st, int *upper_fd, int *work_fd)
+{
+	int fs_fd = sys_fsopen("tmpfs", FSOPEN_CLOEXEC);
+	check_mount_api(fs_fd, "fsopen");
+	check_mount_api(sys_fsconfig(fs_fd, FSCONFIG_SET_STRING,
+				     "mode", "700", 0), "fsconfig");
+	check_mount_api(sys_fsconfig(fs_fd, FSCONFIG_CMD_CREATE,
+				     NULL, NULL, 0), "fsconfig");
+	int tmp_fd = sys_fsmount(fs_fd, FSMOUNT_CLOEXEC, MOUNT_ATTR_NODEV);
+	check_mount_api(tmp_fd, "fsmount");
+	xclose(&fs_fd);
+
+	if (mkdirat(tmp_fd, "upper", 0700) < 0)
+		perror_msg_and_die("mkdir: %s", "upper");
+	if (fchownat(tmp_fd, "upper", st->st_uid, st->st_gid, 0) < 0)
+		perror_msg_and_die("chown: %s", "upper");
+	if (fchmodat(tmp_fd, "upper", st->st_mode & 07777, 0) < 0)
+		perror_msg_and_die("chmod: %s", "upper");
+	if (mkdirat(tmp_fd, "work", 0700) < 0)
+		perror_msg_and_die("mkdir: %s", "work");
+
+	*upper_fd = open_path(tmp_fd, "upper");
+	*work_fd = open_path(tmp_fd, "work");
+
+	return tmp_fd;
+}
+
+static void
+set_layer(int fs_fd, const char *key, int fd)
+{
+	char path[sizeof("/proc/self/fd/") + sizeof(int) * 3];
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	check_mount_api(sys_fsconfig(fs_fd, FSCONFIG_SET_STRING,
+				     key, path, 0), key);
+}
+
+/*
+ * Create a detached overlay mount for the current directory,
+ * which is the chroot directory, and return its descriptor.
+ * The lower layer is lower_fd if specified, otherwise the chroot
+ * directory itself.  The overlay is mounted with the given
+ * MOUNT_ATTR_* flags.
+ */
+int
+create_overlay(int lower_fd, unsigned int attr_flags)
+{
+	int dir_fd = open_path(AT_FDCWD, ".");
+	int upper_fd = -1, work_fd = -1, tmp_fd = -1;
+	struct stat st;
+
+	if (fstat(dir_fd, &st) < 0)
+		perror_msg_and_die("fstat");
+
+	if (chroot_overlay_dir) {
+		open_overlay_dir(&upper_fd, &work_fd);
+		if (fchdir(dir_fd) < 0)
+			perror_msg_and_die("fchdir");
+	} else {
+		tmp_fd = create_overlay_tmpfs(&st, &upper_fd, &work_fd);
+	}
+
+	int fs_fd = sys_fsopen("overlay", FSOPEN_CLOEXEC);
+	check_mount_api(fs_fd, "fsopen");
+	set_layer(fs_fd, "lowerdir", lower_fd >= 0 ? lower_fd : dir_fd);
+	set_layer(fs_fd, "upperdir", upper_fd);
+	set_layer(fs_fd, "workdir", work_fd);
+	check_mount_api(sys_fsconfig(fs_fd, FSCONFIG_CMD_CREATE,
+				     NULL, NULL, 0), "fsconfig");
+	int mnt_fd = sys_fsmount(fs_fd, FSMOUNT_CLOEXEC, attr_flags);
+	check_mount_api(mnt_fd, "fsmount");
+	xclose(&fs_fd);
+
+	xclose(&tmp_fd);
+	xclose(&work_fd);
+	xclose(&upper_fd);
+	xclose(&dir_fd);
+
+	return mnt_fd;
+}
@@ -0,0 +1,15 @@
+/*
+ * The overlay chroot setup for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_OVERLAY_H
+# define HASHER_OVERLAY_H
+
+int create_overlay(int lower_fd, unsigned int attr_flags);
+
+#endif /* !HASHER_OVERLAY_H */
@@ -150,3 +150,77 @@ fd_recv(int ctl, int *fds, unsigned int n_fds, char *data, size_t data_len)
 
 	return 0;
 }
+
+/*
+ * Receive exactly data_len bytes of regular data along with up to max_fds
+ * descriptors that might be attached to them.
+ *
+ * This function may be executed with root privileges.
+ */
+int
+fd_recv_upto(int ctl, int *fds, unsigned int max_fds, unsigned int *n_fds,
+	     char *data, size_t data_len)
+{
+	const size_t clen = sizeof(fds[0]) * max_fds;
+	char buf[CMSG_SPACE(clen)]
+		__attribute__((__aligned__(__alignof__(struct cmsghdr))));
+
+	struct iovec iov = {
+		.iov_base = data,
+		.iov_len = data_len
+	};
+
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = buf,
+		.msg_controllen = sizeof(buf)
+	};
+
+	*n_fds = 0;
+
+	ssize_t rc = recvmsg_retry(ctl, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC);
+	if (rc != (ssize_t) data_len) {
+		if (rc < 0) {
+			perror_msg("recvmsg");
+		} else if (rc) {
+			error_msg("expected size %lu, got %lu",
+				  (unsigned long) data_len,
+				  (unsigned long) rc);
+		} else {
+			error_msg("unexpected EOF");
+		}
+		return -1;
+	}
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg)
+		return 0;
+
+	if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+		error_msg("unexpected ancillary data");
+		return -1;
+	}
+
+	size_t recv_len = cmsg->cmsg_len - CMSG_LEN(0);
+	if (recv_len % sizeof(fds[0]) || recv_len > clen) {
+		error_msg("SCM_RIGHTS: unexpected size %lu",
+			  (unsigned long) recv_len);
+		return -1;
+	}
+
+	memcpy(fds, CMSG_DATA(cmsg), recv_len);
+	*n_fds = (unsigned int) (recv_len / sizeof(fds[0]));
+
+	if (msg.msg_flags & MSG_CTRUNC) {
+		error_msg("SCM_RIGHTS: too many descriptors");
+		return -1;
+	}
+
+	if (CMSG_NXTHDR(&msg, cmsg)) {
+		error_msg("stray ancillary data");
+		return -1;
+	}
+
+	return 0;
+}
@@ -17,5 +17,8 @@ void    fd_send(int ctl, int *fds, unsigned int n_fds,
 		const char *data, size_t data_len) ATTRIBUTE_NONNULL((2));
 int     fd_recv(int ctl, int *fds, unsigned int n_fds,
 		char *data, size_t data_len) ATTRIBUTE_NONNULL((2));
+int     fd_recv_upto(int ctl, int *fds, unsigned int max_fds,
+		     unsigned int *n_fds, char *data, size_t data_len)
+		     ATTRIBUTE_NONNULL((2, 4, 5));
 
 #endif /* !HASHER_PASS_H */
@@ -0,0 +1,143 @@
+/*
+ * The job performance counters module for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root or caller privileges. */
+
+#include "error_prints.h"
+#include "fds.h"
+#include "macros.h"
+#include "perf_counters.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const struct {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+	size_t offset;
+} perf_events[] = {
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+	  offsetof(job_usage_t, instructions) },
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+	  offsetof(job_usage_t, cycles) },
+	{ "cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,
+	  offsetof(job_usage_t, cache_misses) },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,
+	  offsetof(job_usage_t, branch_misses) },
+	{ "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,
+	  offsetof(job_usage_t, task_clock_nsec) },
+};
+
+/*
+ * The totals are collected by the executor and reported by the runner,
+ * so they are kept in a shared anonymous mapping created by the runner
+ * before the executor is forked off.
+ */
+static unsigned long long *perf_totals;
+static int perf_fds[ARRAY_SIZE(perf_events)] = {
+	[0 ... ARRAY_SIZE(perf_events) - 1] = -1
+};
+
+int
+prepare_perf_counters(void)
+{
+	void *p = mmap(NULL, sizeof(*perf_totals) * ARRAY_SIZE(perf_events),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		       -1, 0);
+	if (p == MAP_FAILED) {
+		perror_msg("mmap");
+		return -1;
+	}
+
+	perf_totals = p;
+	return 0;
+}
+
+/*
+ * Open counters on the calling process, disabled until the next execve
+ * and inherited by children forked off afterwards, so that they count
+ * the whole process tree of the job, but nothing before its execve.
+ * Counters that are not supported, e.g. hardware counters in a virtual
+ * machine, are silently skipped.
+ */
+void
+open_perf_counters(void)
+{
+	if (!perf_totals)
+		return;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(perf_events); ++i) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[i].type;
+		attr.config = perf_events[i].config;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+				   PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.enable_on_exec = 1;
+
+		perf_fds[i] = (int) syscall(__NR_perf_event_open, &attr, 0, -1,
+					    -1, PERF_FLAG_FD_CLOEXEC);
+		if (perf_fds[i] < 0)
+			debug_msg("perf_event_open: %s: %s",
+				  perf_events[i].name, strerror(errno));
+	}
+}
+
+/*
+ * Read the totals of the counters after all processes of the job
+ * have been waited for.  If the counters had to be multiplexed,
+ * scale them by the time they were actually running.
+ */
+void
+collect_perf_counters(void)
+{
+	if (!perf_totals)
+		return;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(perf_events); ++i) {
+		uint64_t val[3];
+
+		if (perf_fds[i] < 0)
+			continue;
+
+		if (read(perf_fds[i], val, sizeof(val)) == sizeof(val)) {
+			if (val[2] && val[2] < val[1])
+				val[0] = (uint64_t) ((double) val[0] *
+						     (double) val[1] /
+						     (double) val[2]);
+			perf_totals[i] = val[0];
+		} else {
+			perror_msg("read: %s", perf_events[i].name);
+		}
+
+		(void) xclose(&perf_fds[i]);
+	}
+}
+
+void
+report_perf_counters(job_usage_t *usage)
+{
+	if (!perf_totals)
+		return;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(perf_events); ++i)
+		*(unsigned long long *) ((char *) usage +
+					 perf_events[i].offset) = perf_totals[i];
+}
@@ -0,0 +1,20 @@
+/*
+ * The job performance counters interface for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_PERF_COUNTERS_H
+# define HASHER_PERF_COUNTERS_H
+
+# include "communication.h"
+
+int prepare_perf_counters(void);
+void open_perf_counters(void);
+void collect_perf_counters(void);
+void report_perf_counters(job_usage_t *);
+
+#endif /* !HASHER_PERF_COUNTERS_H */
@@ -0,0 +1,124 @@
+/*
+ * The init of the PID namespace of a chrootuid job
+ * for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root or child privileges. */
+
+#include "error_prints.h"
+#include "fds.h"
+#include "macros.h"
+#include "mount.h"
+#include "pidns_init.h"
+#include "process.h"
+#include "signals.h"
+#include "xmalloc.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Signals that are forwarded by the init to the job process. */
+static const int forwarded_signals[] = {
+	SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGUSR1, SIGUSR2
+};
+
+ATTRIBUTE_NORETURN
+static void
+exit_like(int status)
+{
+	if (WIFEXITED(status))
+		exit(WEXITSTATUS(status));
+	if (WIFSIGNALED(status))
+		exit(128 + WTERMSIG(status));
+	exit(255);
+}
+
+ATTRIBUTE_NORETURN
+static void
+run_init(pid_t job_pid, const sigset_t *mask)
+{
+	for (;;) {
+		int sig = sigwaitinfo(mask, NULL);
+
+		if (sig < 0) {
+			if (errno == EINTR)
+				continue;
+			perror_msg_and_die("sigwaitinfo");
+		}
+
+		if (sig != SIGCHLD) {
+			if (kill(job_pid, sig) < 0 && errno != ESRCH)
+				perror_msg("kill: %d", sig);
+			continue;
+		}
+
+		/* Reap the job process along with all orphans. */
+		int status;
+		pid_t pid;
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			/*
+			 * The exit of the init makes the kernel kill
+			 * all the remaining processes of the namespace.
+			 */
+			if (pid == job_pid)
+				exit_like(status);
+		}
+		if (pid < 0 && errno != EINTR)
+			perror_msg_and_die("waitpid");
+	}
+}
+
+/*
+ * Called by the first process of a new PID namespace, which is its init.
+ * Forks off the job process, and returns in it.  The init itself drops
+ * privileges to uid:gid, reaps all processes of the namespace,
+ * forwards signals to the job process, and exits with its exit status.
+ */
+void
+pidns_init(uid_t uid, gid_t gid)
+{
+	/* Let proc inside the chroot show the new namespace. */
+	remount_proc();
+
+	sigset_t mask, orig_mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	for (size_t i = 0; i < ARRAY_SIZE(forwarded_signals); ++i)
+		sigaddset(&mask, forwarded_signals[i]);
+	xsigprocmask(SIG_BLOCK, &mask, &orig_mask);
+
+	pid_t pid = fork();
+	if (pid < 0)
+		perror_msg_and_die("fork");
+
+	if (!pid) {
+		xsigprocmask(SIG_SETMASK, &orig_mask, NULL);
+		return;
+	}
+
+	program_invocation_short_name =
+		xasprintf("%s: %s", program_invocation_short_name, "init");
+
+	/* The init needs no descriptors but standard ones and log_fd. */
+	xclose(&jobserver_rfd);
+	xclose(&jobserver_wfd);
+	xclose(&status_fd);
+	sanitize_fds();
+
+	if (setgid(gid) < 0)
+		perror_msg_and_die("setgid");
+
+	if (setuid(uid) < 0)
+		perror_msg_and_die("setuid");
+
+	/* Process is no longer privileged at this point. */
+
+	run_init(pid, &mask);
+}
@@ -0,0 +1,17 @@
+/*
+ * The PID namespace init interface for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_PIDNS_INIT_H
+# define HASHER_PIDNS_INIT_H
+
+# include <sys/types.h>
+
+void pidns_init(uid_t uid, gid_t gid);
+
+#endif /* !HASHER_PIDNS_INIT_H */
@@ -0,0 +1,55 @@
+/*
+ * The pressure stall information for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file is executed with root privileges. */
+
+#include "error_prints.h"
+#include "pressure.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Return the share of time in percent over the last 10 seconds
+ * some tasks (or, if full is set, all non-idle tasks) on the host
+ * were stalled on the resource, or -1 if it is unknown.
+ */
+double
+read_pressure(const char *resource, int full)
+{
+	char name[64];
+	snprintf(name, sizeof(name), "/proc/pressure/%s", resource);
+
+	FILE *fp = fopen(name, "r");
+	if (!fp) {
+		if (errno != ENOENT)
+			perror_msg("fopen: %s", name);
+		return -1;
+	}
+
+	const char *kind = full ? "full" : "some";
+	double avg10 = -1;
+	char line[256];
+
+	while (fgets(line, sizeof(line), fp)) {
+		char *p = strchr(line, ' ');
+		if (!p)
+			continue;
+		*p++ = '\0';
+		if (strcmp(line, kind))
+			continue;
+		if (sscanf(p, "avg10=%lf", &avg10) != 1)
+			avg10 = -1;
+		break;
+	}
+
+	fclose(fp);
+	return avg10;
+}
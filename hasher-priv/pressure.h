@@ -0,0 +1,15 @@
+/*
+ * The pressure stall information interface for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_PRESSURE_H
+# define HASHER_PRESSURE_H
+
+double read_pressure(const char *resource, int full);
+
+#endif /* !HASHER_PRESSURE_H */
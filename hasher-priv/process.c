@@ -1,5 +1,5 @@
 /*
- * waitpid_retry function for the hasher-privd server program.
+ * Process management functions for the hasher-privd server program.
  *
  * Copyright (C) 2022  Arseny Maslennikov <arseny@altlinux.org>
  * All rights reserved.
@@ -10,6 +10,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 
 #include "process.h"
@@ -19,3 +20,9 @@ waitpid_retry(pid_t pid, int *wstatus, int options)
 {
 	return (pid_t) TEMP_FAILURE_RETRY(waitpid(pid, wstatus, options));
 }
+
+pid_t
+wait4_retry(pid_t pid, int *wstatus, int options, struct rusage *ru)
+{
+	return (pid_t) TEMP_FAILURE_RETRY(wait4(pid, wstatus, options, ru));
+}
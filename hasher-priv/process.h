@@ -1,5 +1,5 @@
 /*
- * waitpid_retry interface for the hasher-privd server program.
+ * Process management interface for the hasher-privd server program.
  *
  * Copyright (C) 2022  Arseny Maslennikov <arseny@altlinux.org>
  * All rights reserved.
@@ -12,6 +12,9 @@
 
 # include <sys/types.h>
 
+struct rusage;
+
 pid_t waitpid_retry(pid_t pid, int *wstatus, int options);
+pid_t wait4_retry(pid_t pid, int *wstatus, int options, struct rusage *);
 
 #endif /* HASHER_PROCESS_H */
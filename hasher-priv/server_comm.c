@@ -100,3 +100,25 @@ send_response_to_client(int conn, int rc, const char *fmt, ...)
 
 	return rc;
 }
+
+int
+send_usage_to_client(int conn, const job_usage_t *usage)
+{
+	struct iovec iov = {
+		.iov_base = (void *) usage,
+		.iov_len = sizeof(*usage)
+	};
+
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1
+	};
+
+	errno = 0;
+	if (sendmsg_retry(conn, &msg, MSG_NOSIGNAL) < 0 && errno != EPIPE) {
+		perror_msg("sendmsg");
+		return -1;
+	}
+
+	return 0;
+}
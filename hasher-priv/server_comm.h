@@ -14,8 +14,10 @@
 # define HASHER_SERVER_COMM_H
 
 # include "cc_compat.h"
+# include "communication.h"
 
 int send_response_to_client(int conn, int rc, const char *fmt, ...)
 	ATTRIBUTE_FORMAT((printf, 3, 4));
+int send_usage_to_client(int conn, const job_usage_t *);
 
 #endif /* !HASHER_SERVER_COMM_H */
@@ -13,6 +13,7 @@
 #include "chdir.h"
 #include "error_prints.h"
 #include "file_config.h"
+#include "jobserver.h"
 #include "opt_parse.h"
 #include "server_config.h"
 #include "xmalloc.h"
@@ -27,10 +28,22 @@
 
 char *server_loglevel;
 char *server_pidfile;
+char *server_job_cgroup_parent;
 gid_t server_gid;
 int min_uid = MIN_CHANGE_UID;
 int min_gid = MIN_CHANGE_GID;
 unsigned long server_session_timeout;
+unsigned long server_request_timeout = 3;
+int server_listen_backlog = 128;
+unsigned long server_max_job_handlers = 16;
+unsigned long server_netns_pool_size;
+unsigned long server_jobserver_tokens;
+unsigned long server_max_jobs;
+unsigned long server_max_user_jobs;
+unsigned long server_psi_cpu_limit;
+unsigned long server_psi_memory_limit;
+unsigned long server_psi_io_limit;
+unsigned long server_psi_memory_freeze;
 
 static char *server_access_group;
 
@@ -54,12 +67,47 @@ set_server_name_value(const char *name, const char *value, const char *fname)
 {
 	if (!strcasecmp("session_timeout", name)) {
 		server_session_timeout = opt_str2ul(name, value, fname);
+	} else if (!strcasecmp("request_timeout", name)) {
+		server_request_timeout = opt_str2ul(name, value, fname);
+	} else if (!strcasecmp("listen_backlog", name)) {
+		server_listen_backlog = opt_str2int(name, value, fname);
+		if (server_listen_backlog <= 0)
+			opt_bad_value(name, value, fname);
+	} else if (!strcasecmp("max_job_handlers", name)) {
+		server_max_job_handlers = opt_str2ul(name, value, fname);
+		if (!server_max_job_handlers)
+			opt_bad_value(name, value, fname);
+	} else if (!strcasecmp("netns_pool_size", name)) {
+		server_netns_pool_size = opt_str2ul(name, value, fname);
+	} else if (!strcasecmp("jobserver_tokens", name)) {
+		server_jobserver_tokens = opt_str2ul(name, value, fname);
+		if (server_jobserver_tokens &&
+		    jobserver_check_tokens(server_jobserver_tokens) < 0)
+			opt_bad_value(name, value, fname);
+	} else if (!strcasecmp("max_jobs", name)) {
+		server_max_jobs = opt_str2ul(name, value, fname);
+	} else if (!strcasecmp("max_user_jobs", name)) {
+		server_max_user_jobs = opt_str2ul(name, value, fname);
+	} else if (!strcasecmp("psi_cpu_limit", name)) {
+		server_psi_cpu_limit = opt_str2ul(name, value, fname);
+	} else if (!strcasecmp("psi_memory_limit", name)) {
+		server_psi_memory_limit = opt_str2ul(name, value, fname);
+	} else if (!strcasecmp("psi_io_limit", name)) {
+		server_psi_io_limit = opt_str2ul(name, value, fname);
+	} else if (!strcasecmp("psi_memory_freeze", name)) {
+		server_psi_memory_freeze = opt_str2ul(name, value, fname);
 	} else if (!strcasecmp("loglevel", name)) {
 		free(server_loglevel);
 		server_loglevel = xstrdup(value);
 	} else if (!strcasecmp("pidfile", name)) {
 		free(server_pidfile);
 		server_pidfile = xstrdup(value);
+	} else if (!strcasecmp("job_cgroup_parent", name)) {
+		const char *path = value + strspn(value, "/");
+		if (!*path)
+			opt_bad_value(name, value, fname);
+		free(server_job_cgroup_parent);
+		server_job_cgroup_parent = xstrdup(path);
 	} else if (!strcasecmp("access_group", name)) {
 		free(server_access_group);
 		server_access_group = xstrdup(value);
@@ -15,8 +15,20 @@
 void configure_server(void);
 
 extern unsigned long server_session_timeout;
+extern unsigned long server_request_timeout;
+extern int server_listen_backlog;
+extern unsigned long server_max_job_handlers;
+extern unsigned long server_netns_pool_size;
+extern unsigned long server_jobserver_tokens;
+extern unsigned long server_max_jobs;
+extern unsigned long server_max_user_jobs;
+extern unsigned long server_psi_cpu_limit;
+extern unsigned long server_psi_memory_limit;
+extern unsigned long server_psi_io_limit;
+extern unsigned long server_psi_memory_freeze;
 extern char *server_loglevel;
 extern char *server_pidfile;
+extern char *server_job_cgroup_parent;
 extern gid_t server_gid;
 
 extern int min_uid;
@@ -33,7 +33,7 @@
  * This function may be executed with root privileges.
  */
 int
-srv_listen(const char *file_name)
+srv_listen(const char *file_name, int backlog)
 {
 	struct sockaddr_un sun = { .sun_family = AF_UNIX };
 	xsprintf(sun.sun_path, "%s", file_name);
@@ -56,7 +56,7 @@ srv_listen(const char *file_name)
 		return -1;
 	}
 
-	if (listen(fd, 16)) {
+	if (listen(fd, backlog)) {
 		perror_msg("listen: %s", sun.sun_path);
 		xclose(&fd);
 		return -1;
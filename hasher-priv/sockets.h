@@ -14,7 +14,7 @@
 #include "cc_compat.h"
 #include <sys/types.h>
 
-int srv_listen(const char *)  ATTRIBUTE_NONNULL((1));
+int srv_listen(const char *, int backlog)  ATTRIBUTE_NONNULL((1));
 int srv_connect(const char *, const char *) ATTRIBUTE_NONNULL((1, 2));
 int srv_try_connect(const char *, const char *) ATTRIBUTE_NONNULL((1, 2));
 
@@ -10,16 +10,81 @@
 
 /* Code in this file may be executed with root privileges. */
 
+#include "caller_data.h"
+#include "cgroup.h"
+#include "epoll.h"
 #include "error_prints.h"
 #include "executors.h"
+#include "fds.h"
+#include "logging.h"
+#include "pass.h"
 #include "spawn_killuid.h"
 #include "process.h"
+#include "signals.h"
+#include "title.h"
 
 #include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 
+/*
+ * Processes and IPC objects left behind by a chrootuid job are killed
+ * and purged by the session server in background right after the job
+ * has finished, rather than synchronously when the next job starts.
+ *
+ * For this purpose, every job handler inherits one end of a
+ * SOCK_SEQPACKET socket pair, the other end is polled by the session
+ * server.  The runner of a chrootuid job sends KILLUID_JOB_START before
+ * it spawns the executor, and waits for the answer telling whether
+ * there is nothing left to kill, which the session server delays while
+ * the cleanup is in progress.  The runner sends KILLUID_JOB_DONE once
+ * the job has finished; closing the socket counts as well.  The cleanup
+ * starts when no chrootuid job of the session is running.
+ *
+ * A job that is bound to run in an IPC namespace of its own, and either
+ * in a job cgroup or in a PID namespace of its own, does not leave
+ * anything behind for killuid, which walks all processes and IPC objects
+ * on the host.
+ * The runner of such a job sends KILLUID_JOB_START_CONTAINED instead,
+ * along with the job cgroup, if any.  All processes of the job cgroup
+ * are killed by cgroup.kill once the job has finished; the runner is not
+ * among them, as only the executor and its descendants join the job
+ * cgroup.  All processes of the PID namespace are killed by the kernel
+ * when its init exits; IPC objects go away along with the IPC namespace.
+ */
+enum {
+	KILLUID_JOB_START = 'S',
+	KILLUID_JOB_START_CONTAINED = 'C',
+	KILLUID_JOB_DONE = 'D',
+};
+
+struct killuid_job {
+	struct killuid_job *next;
+	int fd;
+	int cgroup_fd;
+	int contained;
+	int started;
+	int waiting;
+};
+
+/* The end of the socket pair inherited by the job handler being spawned. */
+static int job_fds[2] = { -1, -1 };
+
+static struct killuid_job *killuid_jobs;
+static unsigned int n_running;
+
+/* The process that kills the leftovers of the finished jobs. */
+static pid_t killuid_pid;
+
+/* Whether nothing has been left behind since the last cleanup. */
+static int leftovers_killed;
+
+/* Set in the runner if the executor does not have to call killuid. */
+int killuid_done;
+
 void
 spawn_killuid(void)
 {
@@ -47,3 +112,296 @@ spawn_killuid(void)
 
 	error_msg_and_die("unrecognized status %#x", status);
 }
+
+/*
+ * Create a socket pair for the job handler that is about to be spawned
+ * by the session server.
+ */
+void
+killuid_prepare_job(void)
+{
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, job_fds)) {
+		perror_msg("socketpair");
+		job_fds[0] = job_fds[1] = -1;
+	}
+}
+
+/*
+ * Start polling the socket pair of the job handler that has been spawned,
+ * or discard it if no handler has been spawned.
+ */
+void
+killuid_track_job(int fd_ep, pid_t handler_pid)
+{
+	xclose(&job_fds[1]);
+
+	if (job_fds[0] < 0)
+		return;
+
+	struct killuid_job *j = NULL;
+	if (handler_pid > 0 && (j = calloc(1, sizeof(*j))) &&
+	    epoll_add_in(fd_ep, job_fds[0]) == 0) {
+		j->fd = job_fds[0];
+		j->cgroup_fd = -1;
+		j->next = killuid_jobs;
+		killuid_jobs = j;
+		job_fds[0] = -1;
+		return;
+	}
+
+	free(j);
+	xclose(&job_fds[0]);
+}
+
+/* Close the descriptors of the session server in a job handler. */
+void
+killuid_close_jobs(void)
+{
+	xclose(&job_fds[0]);
+
+	while (killuid_jobs) {
+		struct killuid_job *j = killuid_jobs;
+		killuid_jobs = j->next;
+		xclose(&j->cgroup_fd);
+		xclose(&j->fd);
+		free(j);
+	}
+}
+
+/* Forget the cleanup, e.g. because the build users have changed. */
+void
+killuid_reset(void)
+{
+	leftovers_killed = 0;
+}
+
+static void
+answer_job(struct killuid_job *j)
+{
+	char clean = (char) leftovers_killed;
+
+	if (send(j->fd, &clean, sizeof(clean),
+		 MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EPIPE)
+		perror_msg("send");
+
+	j->waiting = 0;
+
+	/* A job that may leave something behind makes killuid necessary. */
+	if (!j->contained)
+		leftovers_killed = 0;
+}
+
+ATTRIBUTE_NORETURN
+static void
+killuid_cleaner(void)
+{
+	setproctitle("killuid %s/%u:%u", caller_user, caller_uid, caller_num);
+
+	/*
+	 * As we are not going to handle signals, unblock them.
+	 */
+	unblock_all_signals();
+
+	killuid_close_jobs();
+
+	exit(do_killuid());
+}
+
+static void
+spawn_killuid_cleaner(void)
+{
+	if (killuid_pid > 0)
+		return;
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror_msg("fork");
+		return;
+	}
+	if (!pid)
+		killuid_cleaner();
+
+	killuid_pid = pid;
+}
+
+static void
+finish_job(int fd_ep, struct killuid_job *j, int remove)
+{
+	if (j->started) {
+		j->started = 0;
+
+		if (j->cgroup_fd >= 0 && kill_cgroup_fd(j->cgroup_fd) < 0)
+			leftovers_killed = 0;
+		xclose(&j->cgroup_fd);
+
+		if (!--n_running && !leftovers_killed)
+			spawn_killuid_cleaner();
+	}
+
+	if (!remove)
+		return;
+
+	struct killuid_job **jp = &killuid_jobs;
+	while (*jp != j)
+		jp = &(*jp)->next;
+	*jp = j->next;
+
+	(void) epoll_del(fd_ep, j->fd);
+	xclose(&j->fd);
+	free(j);
+}
+
+/* Returns 1 if the descriptor belongs to a job handler, 0 otherwise. */
+int
+killuid_handle_event(int fd_ep, int fd)
+{
+	struct killuid_job *j = killuid_jobs;
+	while (j && j->fd != fd)
+		j = j->next;
+	if (!j)
+		return 0;
+
+	char c;
+	ssize_t n = recv(fd, &c, sizeof(c), MSG_DONTWAIT | MSG_PEEK);
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+		      errno == EINTR))
+		return 1;
+
+	int cgroup_fd = -1;
+	if (n > 0) {
+		unsigned int n_fds;
+		if (fd_recv_upto(fd, &cgroup_fd, 1, &n_fds, &c, sizeof(c)) < 0)
+			n = -1;
+		if (!n_fds)
+			cgroup_fd = -1;
+	}
+
+	if (n <= 0) {
+		/* The job handler, or the runner, has terminated. */
+		finish_job(fd_ep, j, 1);
+	} else if ((c == KILLUID_JOB_START ||
+		    c == KILLUID_JOB_START_CONTAINED) && !j->started) {
+		j->started = 1;
+		j->contained = c == KILLUID_JOB_START_CONTAINED;
+		if (j->contained) {
+			j->cgroup_fd = cgroup_fd;
+			cgroup_fd = -1;
+		}
+
+		/*
+		 * Unless it is known that nothing has been left behind,
+		 * kill the leftovers first if no other job is running.
+		 */
+		if (!n_running++ && !leftovers_killed)
+			spawn_killuid_cleaner();
+
+		if (killuid_pid > 0)
+			j->waiting = 1;
+		else
+			answer_job(j);
+	} else if (c == KILLUID_JOB_DONE) {
+		finish_job(fd_ep, j, 0);
+	} else {
+		error_msg("%s/%u:%u: unexpected job notification",
+			  caller_user, caller_uid, caller_num);
+		finish_job(fd_ep, j, 1);
+	}
+
+	xclose(&cgroup_fd);
+	return 1;
+}
+
+/*
+ * Returns 1 if the given process was the killuid cleaner, 0 otherwise.
+ */
+int
+killuid_reaped(pid_t pid, int status)
+{
+	if (!killuid_pid || pid != killuid_pid)
+		return 0;
+
+	killuid_pid = 0;
+	leftovers_killed = WIFEXITED(status) &&
+			   WEXITSTATUS(status) == EXIT_SUCCESS;
+	if (!leftovers_killed)
+		error_msg("%s/%u:%u: killuid %d failed",
+			  caller_user, caller_uid, caller_num, pid);
+
+	/* All the waiting jobs have started after the cleanup. */
+	int clean = leftovers_killed;
+	for (struct killuid_job *j = killuid_jobs; j; j = j->next) {
+		if (j->waiting) {
+			leftovers_killed = clean;
+			answer_job(j);
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Notify the session server that the chrootuid job is about to start,
+ * and wait until the leftovers of the previous jobs are killed,
+ * if they are being killed.  If the job is contained, it is not going
+ * to leave anything behind; cgroup_fd, if valid, is its job cgroup.
+ * Sets killuid_done if the executor does not have to kill the leftovers
+ * itself.  Returns -1 if the client has gone away while waiting,
+ * 0 otherwise.
+ */
+int
+killuid_start_job(int conn, int contained, int cgroup_fd)
+{
+	int fd = job_fds[1];
+	char c = contained ? KILLUID_JOB_START_CONTAINED : KILLUID_JOB_START;
+
+	if (!contained)
+		cgroup_fd = -1;
+
+	if (fd < 0)
+		return 0;
+
+	if (cgroup_fd >= 0)
+		fd_send(fd, &cgroup_fd, 1, &c, sizeof(c));
+	else if (send(fd, &c, sizeof(c), MSG_NOSIGNAL) != (ssize_t) sizeof(c))
+		return 0;
+
+	for (;;) {
+		struct pollfd pfd[] = {
+			{ .fd = fd, .events = POLLIN },
+			{ .fd = conn, .events = POLLRDHUP },
+		};
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror_msg("poll");
+			return 0;
+		}
+
+		if (pfd[1].revents) {
+			info_msg("client has gone away while waiting"
+				 " for the leftovers to be killed");
+			return -1;
+		}
+
+		if (pfd[0].revents)
+			break;
+	}
+
+	if (recv(fd, &c, sizeof(c), 0) != (ssize_t) sizeof(c))
+		return 0;
+
+	killuid_done = c == 1;
+	return 0;
+}
+
+/* Notify the session server that the chrootuid job has finished. */
+void
+killuid_finish_job(void)
+{
+	char c = KILLUID_JOB_DONE;
+
+	if (job_fds[1] >= 0)
+		(void) send(job_fds[1], &c, sizeof(c), MSG_NOSIGNAL);
+	xclose(&job_fds[1]);
+}
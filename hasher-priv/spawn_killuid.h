@@ -10,6 +10,19 @@
 #ifndef HASHER_SPAWN_KILLUID_H
 # define HASHER_SPAWN_KILLUID_H
 
+# include <sys/types.h>
+
 void spawn_killuid(void);
 
+void killuid_prepare_job(void);
+void killuid_track_job(int fd_ep, pid_t handler_pid);
+void killuid_close_jobs(void);
+void killuid_reset(void);
+int killuid_handle_event(int fd_ep, int fd);
+int killuid_reaped(pid_t, int status);
+int killuid_start_job(int conn, int contained, int cgroup_fd);
+void killuid_finish_job(void);
+
+extern int killuid_done;
+
 #endif /* !HASHER_SPAWN_KILLUID_H */
@@ -52,10 +52,8 @@ unix_listen(const char *file_name)
 /* This function may be executed with root privileges. */
 
 int
-log_listen(void)
+log_listen(const char *log_path)
 {
-	static const char log_path[] = "log";
-
 	int fd = unix_listen(log_path);
 
 	if (fd >= 0 && chmod(log_path, 0622)) {
@@ -12,6 +12,6 @@
 
 int unix_listen(const char *);
 int unix_accept(int fd);
-int log_listen(void);
+int log_listen(const char *);
 
 #endif /* !HASHER_UNIX_H */
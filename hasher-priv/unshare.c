@@ -11,6 +11,7 @@
 
 #include "caller_config.h"
 #include "error_prints.h"
+#include "fds.h"
 #include "net.h"
 #include "unshare.h"
 #include <errno.h>
@@ -18,6 +19,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mount.h>
 
 #ifndef CLONE_NEWNS
 # define CLONE_NEWNS	0x00020000
@@ -28,9 +30,15 @@
 #ifndef CLONE_NEWIPC
 # define CLONE_NEWIPC	0x08000000
 #endif
+#ifndef CLONE_NEWPID
+# define CLONE_NEWPID	0x20000000
+#endif
 #ifndef CLONE_NEWNET
 # define CLONE_NEWNET	0x40000000
 #endif
+#ifndef MS_SLAVE
+# define MS_SLAVE	(1 << 19)
+#endif
 
 static int
 do_unshare(int clone_flags, const char *clone_name,
@@ -64,17 +72,49 @@ void
 unshare_mount(void)
 {
 	do_unshare(CLONE_NEWNS, "CLONE_NEWNS", 0, "mount namespace");
+
+	/*
+	 * Just in case that some filesystem is mounted as shared,
+	 * remount it as slave in our namespace so that
+	 * no further mounts show up outside.
+	 */
+	if (mount("/", "/", NULL, MS_SLAVE | MS_REC, NULL) < 0 &&
+	    errno != EINVAL)
+		perror_msg_and_die("mount MS_SLAVE");
 }
 
 void
 unshare_network(void)
 {
+	/* Prefer a ready network namespace from the pool, if any. */
+	if (netns_fd >= 0 && share_network <= 0) {
+		int rc = setns(netns_fd, CLONE_NEWNET);
+		if (rc < 0)
+			perror_msg("setns: %s", "net");
+		xclose(&netns_fd);
+		if (!rc)
+			return;
+	}
+	xclose(&netns_fd);
+
 	if (do_unshare(CLONE_NEWNET, "CLONE_NEWNET", share_network, "network") < 0)
 		return;
 
 	setup_network();
 }
 
+/*
+ * Unless share_pid is enabled, create a new PID namespace for the children
+ * of the calling process, the next child becomes its init.
+ * Returns 0 if the namespace has been created.
+ */
+int
+unshare_pid(void)
+{
+	return do_unshare(CLONE_NEWPID, "CLONE_NEWPID", share_pid,
+			  "PID namespace");
+}
+
 void
 unshare_uts(void)
 {
@@ -13,6 +13,7 @@
 void unshare_ipc(void);
 void unshare_mount(void);
 void unshare_network(void);
+int unshare_pid(void);
 void unshare_uts(void);
 
 #endif /* !HASHER_UNSHARE_H */
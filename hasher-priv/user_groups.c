@@ -0,0 +1,143 @@
+/*
+ * The supplementary group lists cache for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+/* Code in this file may be executed with root privileges. */
+
+#include "caller_config.h"
+#include "caller_data.h"
+#include "error_prints.h"
+#include "macros.h"
+#include "mount.h"
+#include "user_groups.h"
+#include "xmalloc.h"
+
+#include <grp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/*
+ * Supplementary group lists of the caller, user1, and user2 are
+ * looked up by the session server once, so that jobs inherit them
+ * instead of making NSS lookups, which may be slow, every time.
+ * The cache is dropped when /etc/passwd or /etc/group changes.
+ */
+struct user_groups {
+	char *user;
+	gid_t gid;
+	gid_t *list;
+	size_t len;
+};
+
+static struct user_groups *cache;
+static size_t cache_size;
+
+static const char *const db_files[] = { "/etc/passwd", "/etc/group" };
+static struct stat db_stats[ARRAY_SIZE(db_files)];
+
+static int
+is_db_changed(void)
+{
+	int changed = 0;
+
+	for (size_t i = 0; i < ARRAY_SIZE(db_files); ++i) {
+		struct stat st;
+
+		if (stat(db_files[i], &st) < 0)
+			memset(&st, 0, sizeof(st));
+		if (st.st_dev != db_stats[i].st_dev ||
+		    st.st_ino != db_stats[i].st_ino ||
+		    st.st_size != db_stats[i].st_size ||
+		    st.st_mtim.tv_sec != db_stats[i].st_mtim.tv_sec ||
+		    st.st_mtim.tv_nsec != db_stats[i].st_mtim.tv_nsec)
+			changed = 1;
+		db_stats[i] = st;
+	}
+
+	return changed;
+}
+
+static void
+drop_user_groups(void)
+{
+	for (size_t i = 0; i < cache_size; ++i) {
+		free(cache[i].user);
+		free(cache[i].list);
+	}
+	free(cache);
+	cache = 0;
+	cache_size = 0;
+}
+
+static struct user_groups *
+lookup_user_groups(const char *user, gid_t gid)
+{
+	for (size_t i = 0; i < cache_size; ++i)
+		if (cache[i].gid == gid && !strcmp(cache[i].user, user))
+			return &cache[i];
+
+	int n = 0;
+	(void) getgrouplist(user, gid, NULL, &n);
+	gid_t *list = xcalloc((size_t) n + 1, sizeof(*list));
+	if (getgrouplist(user, gid, list, &n) < 0)
+		error_msg_and_die("getgrouplist(%s, %u) failed", user, gid);
+
+	cache = xreallocarray(cache, cache_size + 1, sizeof(*cache));
+	struct user_groups *p = &cache[cache_size++];
+	p->user = xstrdup(user);
+	p->gid = gid;
+	p->list = list;
+	p->len = (size_t) n;
+	return p;
+}
+
+/*
+ * Called by the session server after configure_caller():
+ * look up supplementary group lists of the caller, user1, and user2.
+ */
+void
+prepare_user_groups(void)
+{
+	drop_user_groups();
+	(void) is_db_changed();
+
+	(void) lookup_user_groups(caller_user, caller_gid);
+	(void) lookup_user_groups(change_user1, change_gid1);
+	(void) lookup_user_groups(change_user2, change_gid2);
+
+	endgrent();
+}
+
+/*
+ * Called by the session server before handling a request:
+ * if the user or group database has changed since the lookup,
+ * look up the group lists and the group names in mount options again.
+ */
+void
+refresh_user_groups(void)
+{
+	if (!is_db_changed())
+		return;
+
+	prepare_user_groups();
+	refresh_mount_options();
+}
+
+/*
+ * Returns the supplementary group list of the given user,
+ * looking it up only if it is not in the cache.
+ */
+const gid_t *
+get_user_groups(const char *user, gid_t gid, size_t *len)
+{
+	struct user_groups *p = lookup_user_groups(user, gid);
+
+	*len = p->len;
+	return p->list;
+}
@@ -0,0 +1,19 @@
+/*
+ * The supplementary group lists cache for the hasher-privd server program.
+ *
+ * Copyright (C) 2026  agent <agent@local>
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef HASHER_USER_GROUPS_H
+# define HASHER_USER_GROUPS_H
+
+# include <sys/types.h>
+
+void prepare_user_groups(void);
+void refresh_user_groups(void);
+const gid_t *get_user_groups(const char *user, gid_t gid, size_t *len);
+
+#endif /* !HASHER_USER_GROUPS_H */